@@ -3,12 +3,17 @@
 #include <glm/gtc/matrix_transform.hpp> // For glm::perspective
 #include <glm/gtc/quaternion.hpp>       // glm::quat
 #include <cstdlib>                      // For std::rand()
+#include <cstring>                      // For std::memcpy()
+#include <sstream>
+#include <string_view>
 #include "shapes.h"
+#include "meshprocessing.h"
 
 #include "modelloader.h"
 #include "physics.h"
 
-App::App()
+App::App(AppOptions appOptions)
+    : options{std::move(appOptions)}
 {
     AppSingleton::get().Instances.push_back(this);
 }
@@ -38,16 +43,29 @@ int App::initGLFW()
     glfwSetWindowUserPointer(wp, this);
     glfwSetFramebufferSizeCallback(wp, framebuffer_size_callback);
     glfwSetScrollCallback(wp, scroll_callback);
+    glfwSetWindowRefreshCallback(wp, refresh_callback);
+    return 1;
+}
+
+int App::initHeadless()
+{
+    headless = std::make_unique<HeadlessContext>();
+    if (!headless->valid())
+    {
+        headless.reset();
+        return -1;
+    }
     return 1;
 }
 
 int App::initOpenGL()
 {
-    glfwMakeContextCurrent(wp);
+    if (wp != nullptr)
+        glfwMakeContextCurrent(wp);
 
     // glad: load all OpenGL function pointers
     // ---------------------------------------
-    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+    if (!gladLoadGLLoader(headless ? (GLADloadproc)HeadlessContext::procAddress : (GLADloadproc)glfwGetProcAddress))
     {
         std::cout << "Failed to initialize GLAD" << std::endl;
         return -1;
@@ -62,9 +80,26 @@ int App::initOpenGL()
     // glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS); // If you want to ensure the error happens exactly after the error on the same thread.
     glDebugMessageCallback(&errorCallback, this);
 
+    GpuMemory::get().setBudget(GPU_MEMORY_BUDGET);
     bloomEffect = std::make_unique<Bloom>(SCR_WIDTH, SCR_HEIGHT);
+    bloomEffect->setMethod(options.bloomMethod);
+    renderGraph = std::make_unique<RenderGraph>();
+    if (headless)
+    {
+        // Without a window the final image goes to an offscreen framebuffer
+        headless->createTarget(SCR_WIDTH, SCR_HEIGHT);
+        bloomEffect->setOutput(headless->framebuffer());
+    }
+    uploadRing = std::make_unique<UploadRing>(UPLOAD_RING_FRAME_SIZE, FRAMES_IN_FLIGHT);
+    if (!options.capturePrefix.empty())
+        frameCapture = std::make_unique<FrameCapture>(options.capturePrefix);
+    if (!headless)
+        framePacer = std::make_unique<FramePacer>();
+    // Headless runs stay at full resolution so they're comparable
+    if (DYNAMIC_RESOLUTION && !headless)
+        dynamicResolution = std::make_unique<DynamicResolution>(TARGET_FRAME_MS);
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    GLState::get().bindFramebuffer(GL_FRAMEBUFFER, 0);
 
     return 1;
 }
@@ -77,7 +112,34 @@ void App::showFPS()
     if (elapsed >= 1000)
     {
         const auto fps = frameCount * 1000.f / elapsed;
-        std::string title{"Space Sim, fps: " + std::to_string(fps) + ", time dilation: " + std::to_string(!bPause * timeDilation) + ", camera speed: " + std::to_string(cameraSpeed)};
+        std::string title{"Space Sim, fps: " + std::to_string(fps) + ", time dilation: " + std::to_string(!bPause * timeDilation) + ", camera speed: " + std::to_string(cameraSpeed)
+            + ", triangles: " + std::to_string(trianglesSubmitted) + ", upload stalls: " + std::to_string(uploadRing->stalls()) + ", upload failures: " + std::to_string(uploadRing->failures())};
+        if (bImpostors)
+            title += ", impostors: " + std::to_string(impostors->drawn());
+        else if (bGpuCulling)
+            title += ", visible (gpu/cpu): " + std::to_string(gpuCulling->visibleObjects()) + "/" + std::to_string(gpuCulling->cpuVisibleObjects());
+        title += std::string{", trails: "} + (bGpuTrails ? "gpu" : "cpu");
+        if (bOcclusionCulling)
+            title += ", occluded: " + std::to_string(occlusion.occluded()) + "/" + std::to_string(occlusion.tested());
+        if (frameCapture)
+            title += ", captured: " + std::to_string(frameCapture->frames()) + " (stalls: " + std::to_string(frameCapture->stalls()) + ")";
+        if (dynamicResolution)
+            title += ", render scale: " + std::to_string(dynamicResolution->scale()) + " (gpu " + std::to_string(dynamicResolution->gpuMs())
+                + "ms, blur 1/" + std::to_string(dynamicResolution->blurDivisor()) + ")";
+        title += std::string{", bloom: "} + Bloom::methodName(bloomEffect->getMethod());
+        title += ", render targets: " + std::to_string(renderGraph->targets()) + " (aliased: " + std::to_string(renderGraph->aliased()) + ")";
+        title += ", latency avg/max: " + std::to_string(framePacer->latencyMs()) + "/" + std::to_string(framePacer->maxLatencyMs()) + "ms"
+            + (bLowLatency ? " (low latency)" : "");
+        if (0 < damage.skipped())
+            title += ", idle frames skipped: " + std::to_string(damage.skipped());
+        title += ", gpu memory: " + std::to_string(GpuMemory::get().bytes() / (1024 * 1024)) + "MB";
+        title += ", lights: " + std::to_string(lightClusters->lightCount());
+        const auto glCalls = GLState::get().lastFrame();
+        title += ", gl state calls (issued/elided): " + std::to_string(glCalls.issued) + "/" + std::to_string(glCalls.elided);
+        title += ", transforms rebuilt: " + std::to_string(transforms.recomputed()) + "/" + std::to_string(transforms.size());
+        std::ostringstream frameTimes{};
+        frameTimes << ", frame ms p50/p95/p99/max: " << frameStats.cpu() << ", gpu: " << frameStats.gpu();
+        title += frameTimes.str();
         glfwSetWindowTitle(wp, title.c_str());
         frameCount = 0;
         timer.reset();
@@ -90,15 +152,6 @@ void App::processInput(float deltaTime)
     if (glfwGetKey(wp, GLFW_KEY_ESCAPE) == GLFW_PRESS)
         glfwSetWindowShouldClose(wp, true);
 
-    
-    double xPos, yPos;
-    glfwGetCursorPos(wp, &xPos, &yPos);
-    double deltaX{xPos - mouseXPos}, deltaY{yPos - mouseYPos};
-    deltaX *= deltaTime * CAMERA_ROTATION_SPEED;
-    deltaY *= deltaTime * CAMERA_ROTATION_SPEED;
-    mouseXPos = xPos;
-    mouseYPos = yPos;
-    
     auto& [pTrans, pCamera] = EM.get<component::trans, component::camera>(playerEntity);
 
     bool bAlt{glfwGetKey(wp, GLFW_KEY_LEFT_ALT) == GLFW_PRESS}, bRMB{glfwGetMouseButton(wp, 1) == GLFW_PRESS};
@@ -163,12 +216,6 @@ void App::processInput(float deltaTime)
         }
 
 
-
-        pCamera.pitch += deltaY;
-        pCamera.yaw += deltaX;
-        pTrans.rot = glm::quat{std::cosf(pCamera.pitch * 0.5f), std::sinf(pCamera.pitch * 0.5f), 0.f, 0.f} *
-                     glm::quat{std::cosf(pCamera.yaw * 0.5f), 0.f, std::sinf(pCamera.yaw * 0.5f), 0.f};
-
         pCamera.view = component::trans::createViewMat(pTrans, bObjectCentric);
     } else {
         if (mouseWheelDist < -0.1f || 0.1f < mouseWheelDist) {
@@ -185,99 +232,438 @@ void App::processInput(float deltaTime)
         bPause = !bPause;
     bSpacePressed = bNewSpace;
 
+    bool bNewG = glfwGetKey(wp, GLFW_KEY_G) == GLFW_PRESS;
+    if (bNewG != bGPressed && bNewG)
+    {
+        bGpuCulling = !bGpuCulling;
+        damage.damage();
+    }
+    bGPressed = bNewG;
+
+    bool bNewI = glfwGetKey(wp, GLFW_KEY_I) == GLFW_PRESS;
+    if (bNewI != bIPressed && bNewI)
+    {
+        bImpostors = !bImpostors;
+        damage.damage();
+    }
+    bIPressed = bNewI;
+
+    bool bNewO = glfwGetKey(wp, GLFW_KEY_O) == GLFW_PRESS;
+    if (bNewO != bOPressed && bNewO)
+    {
+        bOcclusionCulling = !bOcclusionCulling;
+        damage.damage();
+    }
+    bOPressed = bNewO;
+
+    bool bNewT = glfwGetKey(wp, GLFW_KEY_T) == GLFW_PRESS;
+    if (bNewT != bTPressed && bNewT)
+    {
+        bGpuTrails = !bGpuTrails;
+        particles->setGpuTrails(bGpuTrails);
+        damage.damage();
+    }
+    bTPressed = bNewT;
+
+    bool bNewTrace = glfwGetKey(wp, GLFW_KEY_F12) == GLFW_PRESS;
+    if (bNewTrace != bTracePressed && bNewTrace)
+        Tracer::get().writeChrome(TRACE_FILE);
+    bTracePressed = bNewTrace;
+
+    bool bNewFrameStats = glfwGetKey(wp, GLFW_KEY_F1) == GLFW_PRESS;
+    if (bNewFrameStats != bFrameStatsPressed && bNewFrameStats)
+    {
+        bShowFrameStats = !bShowFrameStats;
+        damage.damage();
+    }
+    bFrameStatsPressed = bNewFrameStats;
+
+    bool bNewCsv = glfwGetKey(wp, GLFW_KEY_F2) == GLFW_PRESS;
+    if (bNewCsv != bCsvPressed && bNewCsv)
+        frameStats.writeCsv(FRAME_STATS_FILE);
+    bCsvPressed = bNewCsv;
+
+    bool bNewCapture = glfwGetKey(wp, GLFW_KEY_F3) == GLFW_PRESS;
+    if (bNewCapture != bCapturePressed && bNewCapture)
+    {
+        // Recordings continue the numbering, so a new one doesn't overwrite the last
+        if (frameCapture)
+        {
+            capturedFrames = frameCapture->frames();
+            frameCapture.reset();
+        }
+        else
+            frameCapture = std::make_unique<FrameCapture>(options.capturePrefix.empty() ? CAPTURE_PREFIX : options.capturePrefix, capturedFrames);
+    }
+    bCapturePressed = bNewCapture;
+
+    bool bNewR = glfwGetKey(wp, GLFW_KEY_R) == GLFW_PRESS;
+    if (bNewR != bRPressed && bNewR)
+    {
+        if (dynamicResolution)
+            dynamicResolution.reset();
+        else
+            dynamicResolution = std::make_unique<DynamicResolution>(TARGET_FRAME_MS);
+        damage.damage();
+    }
+    bRPressed = bNewR;
+
+    bool bNewB = glfwGetKey(wp, GLFW_KEY_B) == GLFW_PRESS;
+    if (bNewB != bBPressed && bNewB)
+    {
+        // Next method, indexed by the current one
+        constexpr Bloom::method next[]{Bloom::method::DUAL_FILTER, Bloom::method::COMPUTE, Bloom::method::GAUSSIAN};
+        bloomEffect->setMethod(next[static_cast<int>(bloomEffect->getMethod())]);
+        damage.damage();
+    }
+    bBPressed = bNewB;
+
+    bool bNewL = glfwGetKey(wp, GLFW_KEY_L) == GLFW_PRESS;
+    if (bNewL != bLPressed && bNewL)
+        bLowLatency = !bLowLatency;
+    bLPressed = bNewL;
+
+    bool bNewMemory = glfwGetKey(wp, GLFW_KEY_F4) == GLFW_PRESS;
+    if (bNewMemory != bMemoryPressed && bNewMemory)
+        GpuMemory::get().report(std::cout);
+    bMemoryPressed = bNewMemory;
+
     mouseWheelDist = 0.f;
+
+    // In low latency mode the camera turns later, right before the scene is submitted
+    if (!bLowLatency)
+    {
+        mouseLook(deltaTime);
+        framePacer->inputSampled();
+    }
 }
 
-void App::gameloop()
+void App::mouseLook(float deltaTime)
 {
-    // Find time since last frame
-    const auto deltaTime = frameTimer.elapsed<std::chrono::milliseconds>() * 0.001f;
-    frameTimer.reset();
+    double xPos, yPos;
+    glfwGetCursorPos(wp, &xPos, &yPos);
+    double deltaX{xPos - mouseXPos}, deltaY{yPos - mouseYPos};
+    deltaX *= deltaTime * CAMERA_ROTATION_SPEED;
+    deltaY *= deltaTime * CAMERA_ROTATION_SPEED;
+    mouseXPos = xPos;
+    mouseYPos = yPos;
 
-    showFPS();
+    const bool bAlt{glfwGetKey(wp, GLFW_KEY_LEFT_ALT) == GLFW_PRESS}, bRMB{glfwGetMouseButton(wp, 1) == GLFW_PRESS};
+    if (!bAlt && !bRMB)
+        return;
 
-    // input
-    // -----
-    processInput(deltaTime);
+    // Structured bindings of the returned tuple refer to the components
+    auto [pTrans, pCamera] = EM.get<component::trans, component::camera>(playerEntity);
+    pCamera.pitch += deltaY;
+    pCamera.yaw += deltaX;
+    pTrans.rot = glm::quat{std::cosf(pCamera.pitch * 0.5f), std::sinf(pCamera.pitch * 0.5f), 0.f, 0.f} *
+                 glm::quat{std::cosf(pCamera.yaw * 0.5f), 0.f, std::sinf(pCamera.yaw * 0.5f), 0.f};
 
-    // Physics
-    // Timer t{};
-    calcPhysics(std::move(EM.view<component::trans, component::phys>()), !bPause * deltaTime * timeDilation);
-    // std::cout << "Physics took " << t.elapsed<std::chrono::microseconds>() * 0.001f << "ms." << std::endl;
+    pCamera.view = component::trans::createViewMat(pTrans, bAlt);
+}
 
+void App::renderScene(unsigned int framebuffer, const glm::ivec2& renderSize)
+{
     // render
     // ------
-    glBindFramebuffer(GL_FRAMEBUFFER, bloomEffect->input());
-    glEnable(GL_DEPTH_TEST);
+    TraceZone renderZone{"render", true};
+    // State changes go through GLState, which skips the ones that wouldn't change anything
+    auto& state = GLState::get();
+    state.bindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    state.viewport(0, 0, renderSize.x, renderSize.y);
+    state.enable(GL_DEPTH_TEST);
     glClearColor(0.f, 0.f, 0.f, 1.f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    glUseProgram(0);
+    state.useProgram(0);
     unsigned int currentShader{0};
+    trianglesSubmitted = 0;
 
     const auto& [camera, playerTrans] = EM.get<component::camera, component::trans>(playerEntity);
     const auto cameraPos = (playerTrans.flags & playerTrans.OBJECTCENTRIC)
         ? component::trans::objectCentricPos(playerTrans)
         : playerTrans.pos;
 
-    auto view = EM.view<component::mesh, component::mat, component::metadata>();
-    for (const auto &entity : view)
+    // Lights are binned into view clusters before anything reads them (see lightclusters.h)
     {
-        glm::mat4 modelMat{1.f};
-        // (Structured bindings ftw!! ENTT is so cool)
-        auto &[mesh, material] = view.get<component::mesh, component::mat>(entity);
+        TraceZone zone{"LightClusters", true};
+        lightClusters->update(EM, *uploadRing, camera, renderSize);
+    }
 
-        if (!material.bDrawn)
-            continue;
+    // Set shader and shader-params (only if not already set)
+    auto useShader = [&](unsigned int shader) {
+        if (shader == currentShader)
+            return;
 
-        // Set shader and shader-params (only if not already set)
-        if (material.shader != currentShader) {
-            currentShader = material.shader;
-            glUseProgram(material.shader);
-            glUniformMatrix4fv(glGetUniformLocation(material.shader, "uProj"), 1, GL_FALSE, glm::value_ptr(camera.proj));
-            glUniformMatrix4fv(glGetUniformLocation(material.shader, "uView"), 1, GL_FALSE, glm::value_ptr(camera.view));
-
-            glm::vec3 lightPos{0.f, 0.f, 0.f};
-            glUniform3fv(glGetUniformLocation(material.shader, "lightPos"), 1, glm::value_ptr(lightPos));
-            glUniform3fv(glGetUniformLocation(material.shader, "cameraPos"), 1, glm::value_ptr(cameraPos));
-            // glUniform2iv(glGetUniformLocation(material.shader, "screenSize"), 1, glm::value_ptr(screenSize));
-        }
+        currentShader = shader;
+        state.useProgram(shader);
+        glUniform3fv(glGetUniformLocation(shader, "cameraPos"), 1, glm::value_ptr(cameraPos));
+        // glUniform2iv(glGetUniformLocation(shader, "screenSize"), 1, glm::value_ptr(screenSize));
+    };
 
-        // Assign a model matrix if it exist
-        if (EM.has<component::trans>(entity))
+    // Large spheres are drawn into a small CPU depth buffer that the other spheres are tested against (see occlusion.h)
+    {
+        TraceZone zone{"occlusion"};
+        occlusion.begin(camera.view, camera.proj);
+        if (bOcclusionCulling)
         {
-            const auto& transform = EM.get<component::trans>(entity);
-            // if (view.get<component::metadata>(entity).name != "plane")
-            //     transform.rot *= glm::quat{std::cosf(deltaTime * 0.5f), transform.right() * std::sinf(deltaTime * 0.5f)};
-            // transform.pos.x += deltaTime * 0.1f;
-            modelMat = transform.mat();
+            EM.view<component::world, component::mat, component::lod>().each([&](auto entity, const component::world& world, const component::mat& material, const component::lod&) {
+                if (!material.bDrawn)
+                    return;
+                const auto* p = EM.try_get<component::phys>(entity);
+                if ((p != nullptr && p->bStatic) || OCCLUDER_SCREEN_RADIUS <= LodSet::screenRadius(world.pos(), world.maxScale(), cameraPos, camera.proj, renderSize.y))
+                    occlusion.addOccluder(world.mat);
+            });
+            occlusion.rasterize();
         }
-        glUniformMatrix4fv(glGetUniformLocation(material.shader, "uModel"), 1, GL_FALSE, glm::value_ptr(modelMat));
-        glUniform3fv(glGetUniformLocation(material.shader, "color"), 1, glm::value_ptr(material.color));
+    }
 
-        glBindVertexArray(mesh.VAO); // seeing as we only have a single VAO there's no need to bind it every time, but we'll do so to keep things a bit more organized
-        if (mesh.bIndices)
-            glDrawElements(mesh.drawMode, mesh.indexCount, GL_UNSIGNED_INT, 0);
-        else
-            glDrawArrays(mesh.drawMode, 0, mesh.vertexCount);
+    // Draws are recorded on the worker threads and only replayed here (see drawlist.h)
+    {
+        TraceZone zone{"record draws"};
+        drawEntities.clear();
+        for (auto entity : EM.view<component::mesh, component::mat, component::metadata>())
+            drawEntities.push_back(entity);
+
+        const auto f = frustum::fromMatrix(camera.proj * camera.view);
+        const auto zNear = camera.proj[3][2] / (camera.proj[2][2] - 1.f);
+        drawList.record(drawEntities.size(), [&](std::size_t i, std::vector<DrawList::command>& out) {
+            const auto entity = drawEntities[i];
+            const auto& [mesh, material] = EM.get<component::mesh, component::mat>(entity);
+            if (!material.bDrawn)
+                return;
+
+            auto* lod = EM.try_get<component::lod>(entity);
+            // Assign a model matrix if it exist (cached by the transform hierarchy)
+            const auto* world = EM.try_get<component::world>(entity);
+            // Drawn below as an impostor, unless the camera is too close
+            if (bImpostors && lod != nullptr && world != nullptr && impostors->handles(material.shader))
+            {
+                if (SphereImpostors::drawable(world->pos(), world->maxScale(), cameraPos, zNear))
+                    return;
+            }
+            // Drawn below by the GPU culling pass
+            else if (bGpuCulling && lod != nullptr && lod->bGpuCulled)
+                return;
+
+            DrawList::command command{static_cast<unsigned int>(material.shader), world ? world->mat : glm::mat4{1.f}, material.color, mesh};
+
+            // Cull spheres outside the view and swap to the resolution matching the size on screen
+            if (lod != nullptr && world != nullptr)
+            {
+                if (!f.intersects(world->pos(), world->maxScale()) || !occlusion.visible(world->pos(), world->maxScale()))
+                    return;
+
+                const auto radius = LodSet::screenRadius(world->pos(), world->maxScale(), cameraPos, camera.proj, renderSize.y);
+                lod->level = sphereLods.select(radius, lod->level);
+                command.mesh = sphereLods.mesh(lod->level);
+            }
+            out.push_back(command);
+        });
     }
+    trianglesSubmitted += drawList.replay(useShader);
+
+    if (bImpostors)
+    {
+        TraceZone zone{"impostors", true};
+        trianglesSubmitted += impostors->draw(EM, *uploadRing, camera, cameraPos, [&](const glm::vec3& pos, float radius) {
+            return occlusion.visible(pos, radius);
+        }, useShader);
+    }
+    else if (bGpuCulling)
+    {
+        TraceZone zone{"GpuCulling", true};
+        gpuCulling->cull(EM, *uploadRing, camera, cameraPos, renderSize.y, &occlusion);
+        // The culling pass replaced the bound program
+        currentShader = 0;
+        gpuCulling->draw(useShader);
+        trianglesSubmitted += gpuCulling->visibleTriangles();
+    }
+
+    renderZone.end();
 
+    TraceZone particleZone{"particles", true};
     if (!bPause)
         particles->updatePos(EM.view<component::trans, component::particle>());
-    particles->updateShaderData(EM.view<component::particle, component::mat>());
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    particles->render(sphereMesh, camera);
-    glDisable(GL_BLEND);
+    particles->updateShaderData(EM.view<component::particle, component::mat>(), *uploadRing, [&](const glm::vec3& pos, float radius) {
+        return occlusion.visible(pos, radius);
+    });
+
+    // Trails are instanced from a single mesh, so pick the level from the largest trail sphere on screen.
+    // (Trail spheres are drawn at 0.2 times the scale of their body, see particle.vert)
+    float trailRadius{0.f};
+    EM.view<component::trans, component::particle>().each([&](auto ent, const component::trans& t, const component::particle& p) {
+        trailRadius = std::max(trailRadius, LodSet::screenRadius(t.pos, t.scale.x * 0.2f, cameraPos, camera.proj, renderSize.y));
+    });
+    trailLod = sphereLods.select(trailRadius, trailLod);
+    const auto& trailMesh = sphereLods.mesh(trailLod);
+
+    state.enable(GL_BLEND);
+    state.blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    particles->render(trailMesh);
+    state.disable(GL_BLEND);
+    trianglesSubmitted += trailMesh.triangleCount() * particles->instanceCount;
+
+    state.bindVertexArray(0); // no need to unbind it every time
+    particleZone.end();
+}
+
+void App::gameloop()
+{
+    // Find time since last frame
+    const auto frameMs = frameTimer.elapsed<std::chrono::microseconds>() * 0.001f;
+    const auto deltaTime = headless ? HEADLESS_TIMESTEP : frameMs * 0.001f;
+    frameTimer.reset();
+
+    Tracer::get().beginFrame();
+    GLState::get().beginFrame();
+    // The time since last frame belongs to the previous frame (skipped frames only waited for input)
+    if (damage.skipped() == 0)
+        frameStats.push(Tracer::get().frame() - 1, frameMs);
+    frameStats.collect(Tracer::get());
+    TraceZone frameZone{"frame"};
+
+    // input
+    // -----
+    if (wp != nullptr)
+    {
+        showFPS();
+        TraceZone zone{"input"};
+        processInput(deltaTime);
+    }
+
+    // Physics
+    {
+        TraceZone zone{"physics"};
+        calcPhysics(std::move(EM.view<component::trans, component::phys>()), !bPause * deltaTime * timeDilation);
+    }
+
+    // Transforms
+    {
+        TraceZone zone{"transforms"};
+        if (!bPause)
+        {
+            EM.view<component::trans, component::spin>().each([&](auto ent, component::trans& t, const component::spin& s) {
+                t.rot = glm::angleAxis(s.speed * deltaTime * timeDilation, s.axis) * t.rot;
+            });
+        }
+        transforms.update(EM);
+    }
+
+    // Retires finished frames, in low latency mode it waits for the GPU to catch up and
+    // then turns the camera with the latest cursor position, just before the scene is submitted
+    if (wp != nullptr)
+    {
+        TraceZone zone{"frame pacing"};
+        framePacer->wait(bLowLatency ? LOW_LATENCY_QUEUED : 0);
+        if (bLowLatency)
+        {
+            glfwPollEvents();
+            mouseLook(deltaTime);
+            framePacer->inputSampled();
+        }
+    }
+
+    // Nothing on screen changed, so keep the last presented frame and wait for input instead
+    if (SKIP_IDLE_FRAMES && wp != nullptr)
+    {
+        // A capture records every frame
+        const bool bAnimating = !bPause || 0 < transforms.recomputed() || frameCapture;
+        if (!damage.update(EM, EM.get<component::camera>(playerEntity), screenSize, bAnimating))
+        {
+            TraceZone zone{"idle"};
+            glfwWaitEventsTimeout(1.0 / IDLE_FPS);
+            return;
+        }
+    }
+
+    // The scene is rendered at renderSize and upscaled to the window by bloomEffect (see dynamicresolution.h)
+    if (dynamicResolution)
+    {
+        dynamicResolution->beginFrame();
+        const auto size = dynamicResolution->renderSize(screenSize);
+        bloomEffect->setRenderSize(size.x, size.y, dynamicResolution->blurDivisor());
+    }
+    else
+        bloomEffect->setRenderSize(screenSize.x, screenSize.y);
+    const auto renderSize = bloomEffect->renderSize();
 
-    glBindVertexArray(0); // no need to unbind it every time
+    // Per frame data is written straight into mapped memory, see uploadring.h
+    uploadRing->beginFrame();
+    if (auto cameraBlock = uploadRing->allocate(2 * sizeof(glm::mat4)))
+    {
+        const auto& camera = EM.get<component::camera>(playerEntity);
+        std::memcpy(cameraBlock.ptr, glm::value_ptr(camera.proj), sizeof(glm::mat4));
+        std::memcpy(cameraBlock.ptr + sizeof(glm::mat4), glm::value_ptr(camera.view), sizeof(glm::mat4));
+        uploadRing->bindRange(GL_UNIFORM_BUFFER, CAMERA_UBO_BINDING, cameraBlock);
+    }
+
+    // The targets of the passes come from the render graph's pool (see rendergraph.h)
+    const auto scene = renderGraph->create({GL_RGBA16F, bloomEffect->size().x, bloomEffect->size().y, true});
+    renderGraph->addPass("scene", {}, {scene}, [&](RenderGraph& graph) {
+        renderScene(graph.framebuffer(scene), renderSize);
+    });
+    bloomEffect->addPasses(*renderGraph, scene);
+    renderGraph->execute();
+
+    // Read back before the frame stats are drawn over the image
+    if (frameCapture)
+    {
+        TraceZone zone{"capture"};
+        frameCapture->capture(bloomEffect->output(), screenSize.x, screenSize.y);
+    }
 
-    bloomEffect->doTheThing();
+    if (bShowFrameStats)
+        drawFrameStats();
+
+    // Everything reading this frame's ring region has been submitted
+    uploadRing->endFrame();
+    if (dynamicResolution)
+        dynamicResolution->endFrame();
 
     // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
     // -------------------------------------------------------------------------------
-    glfwSwapBuffers(wp);
-    glfwPollEvents();
+    if (wp != nullptr)
+    {
+        TraceZone swapZone{"swap"};
+        glfwSwapBuffers(wp);
+        framePacer->endFrame();
+        glfwPollEvents();
+    }
+}
+
+// Draws the frame time graph over the bottom of the screen
+void App::drawFrameStats()
+{
+    TraceZone zone{"frame stats", true};
+    const auto graph = frameStats.graph();
+    if (frameGraphTex == 0)
+    {
+        glCreateTextures(GL_TEXTURE_2D, 1, &frameGraphTex);
+        GpuMemory::get().textureStorage2D("FrameStats", frameGraphTex, 1, GL_RG32F, static_cast<GLsizei>(graph.size()), 1);
+        glTextureParameteri(frameGraphTex, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTextureParameteri(frameGraphTex, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    }
+    glTextureSubImage2D(frameGraphTex, 0, 0, 0, static_cast<GLsizei>(graph.size()), 1, GL_RG, GL_FLOAT, graph.data());
+
+    const auto cpu = frameStats.cpu();
+    const auto& [quad, material] = EM.get<component::mesh, component::mat>(screenSpacedQuad);
+    auto& state = GLState::get();
+    state.useProgram(material.shader);
+    glUniform1f(glGetUniformLocation(material.shader, "scaleMs"), std::max(2.f * TARGET_FRAME_MS, 1.2f * cpu.max));
+    glUniform1f(glGetUniformLocation(material.shader, "targetMs"), TARGET_FRAME_MS);
+    glUniform4f(glGetUniformLocation(material.shader, "percentiles"), cpu.p50, cpu.p95, cpu.p99, cpu.max);
+    state.bindTexture(0, frameGraphTex);
+    glUniform1i(glGetUniformLocation(material.shader, "tex"), 0);
+
+    state.viewport(0, 0, screenSize.x, screenSize.y / 4);
+    state.enable(GL_BLEND);
+    state.blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    state.bindVertexArray(quad.VAO);
+    quad.draw();
+    state.bindVertexArray(0);
+    state.disable(GL_BLEND);
+    state.viewport(0, 0, screenSize.x, screenSize.y);
 }
 
 int App::init(int currentReward)
@@ -287,7 +673,7 @@ int App::init(int currentReward)
     else if (0 < currentReward)
         return init(currentReward + 2 * initOpenGL());
     else if (-1 < currentReward)
-        return init(currentReward + initGLFW());
+        return init(currentReward + (options.headlessFrames ? initHeadless() : initGLFW()));
     else
         return 0;
 }
@@ -297,6 +683,9 @@ int App::exec()
     if (!init())
         return -1;
 
+    if (headless)
+        return execHeadless();
+
     glfwMakeContextCurrent(wp);
     // Reset cursor position
     glfwGetCursorPos(wp, &mouseXPos, &mouseYPos);
@@ -326,13 +715,68 @@ int App::exec()
     return 0;
 }
 
+// Renders a fixed number of frames without a window and reports the frame times
+int App::execHeadless()
+{
+    setupScene();
+
+    std::cout << "Setup took " << appTimer.elapsed<std::chrono::milliseconds>() << "ms." << std::endl;
+    std::cout << "Rendering " << options.headlessFrames << " frames headless at " << SCR_WIDTH << "x" << SCR_HEIGHT << std::endl;
+    appTimer.reset();
+    frameTimer.reset();
+
+    for (unsigned int i{0}; i < options.headlessFrames; ++i)
+        gameloop();
+
+    // Let the last frames finish so their times are included
+    glFinish();
+    const auto totalMs = appTimer.elapsed<std::chrono::microseconds>() * 0.001f;
+    Tracer::get().beginFrame();
+    GLState::get().beginFrame();
+    frameStats.push(Tracer::get().frame() - 1, frameTimer.elapsed<std::chrono::microseconds>() * 0.001f);
+    frameStats.collect(Tracer::get());
+
+    // Average GPU time of the bloom passes over the kept frames, to compare the methods
+    float bloomMs{0.f};
+    unsigned int bloomFrames{0};
+    const auto lastFrame = Tracer::get().frame() - 1;
+    for (auto frame{lastFrame - std::min(lastFrame - 1, Tracer::MAX_FRAMES - 1)}; frame <= lastFrame; ++frame)
+    {
+        for (const auto& e : Tracer::get().events(frame))
+        {
+            if (e.thread == 0 && std::string_view{e.name}.starts_with("Bloom::"))
+            {
+                bloomMs += e.duration * 0.001f;
+                bloomFrames += std::string_view{e.name} == "Bloom::combine";
+            }
+        }
+    }
+    std::cout << "Bloom (" << Bloom::methodName(options.bloomMethod) << ") gpu ms avg: "
+        << (bloomFrames ? bloomMs / bloomFrames : 0.f) << " over " << bloomFrames << " frames" << std::endl;
+
+    const auto glCalls = GLState::get().lastFrame();
+    std::cout << options.headlessFrames << " frames took " << totalMs << "ms, frame ms p50/p95/p99/max: " << frameStats.cpu()
+        << ", gpu: " << frameStats.gpu() << ", gl state calls (issued/elided): " << glCalls.issued << "/" << glCalls.elided << std::endl;
+    frameStats.writeCsv(FRAME_STATS_FILE);
+    GpuMemory::get().report(std::cout);
+    if (!options.imageFile.empty())
+        headless->writeImage(options.imageFile);
+
+    cleanupScene();
+    bloomEffect.reset();
+    headless.reset();
+    return 0;
+}
+
 void App::setupScene()
 {
-    Shader defaultShader{"src/shaders/default.vert", "src/shaders/default.frag"};
-    Shader sunShader{"src/shaders/phong.vert", "src/shaders/sun.frag"};
-    Shader uvColorShader{"src/shaders/default.vert", "src/shaders/uvcolor.frag"};
-    Shader phongShader{"src/shaders/phong.vert", "src/shaders/phong.frag"};
-    Shader axisShader{"src/shaders/axis.vert", "src/shaders/uvcolor.frag"};
+    // The axis is in full floats, every other mesh in MESH_VERTEX_FORMAT
+    const auto meshFormat = vertexformat::shaderVar(MESH_VERTEX_FORMAT);
+    Shader defaultShader{"src/shaders/default.vert", "src/shaders/default.frag", {meshFormat}};
+    Shader sunShader{"src/shaders/phong.vert", "src/shaders/sun.frag", {meshFormat}};
+    Shader uvColorShader{"src/shaders/default.vert", "src/shaders/uvcolor.frag", {meshFormat}};
+    Shader phongShader{"src/shaders/phong.vert", "src/shaders/phong.frag", {meshFormat}};
+    Shader axisShader{"src/shaders/axis.vert", "src/shaders/uvcolor.frag", {vertexformat::shaderVar(vertexformat::preset::FLOAT)}};
     Shader UIShader{"src/shaders/pass.vert", "src/shaders/ui.frag"};
 
 
@@ -340,11 +784,6 @@ void App::setupScene()
     auto entity = EM.create();
     screenSpacedQuad = entity;
     EM.emplace<component::mat>(entity, *UIShader).bDrawn = false;
-    auto mesh = &EM.emplace<component::mesh>(entity);
-    glGenVertexArrays(1, &mesh->VAO);
-    glBindVertexArray(mesh->VAO);
-    glGenBuffers(1, &mesh->VBO);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh->VBO);
 
     std::vector<vertex> vertices{
         {.pos{-1.f, -1.f, 0.f}, .uv{0.f, 0.f}},
@@ -355,14 +794,11 @@ void App::setupScene()
         {.pos{-1.f, 1.f, 0.f}, .uv{0.f, 1.f}},
         {.pos{-1.f, -1.f, 0.f}, .uv{0.f, 0.f}}
     };
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vertex) * vertices.size(), vertices.data(), GL_STATIC_DRAW);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), nullptr);
-    // glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), (void *)(3 * sizeof(float)));
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(vertex), (void *)(6 * sizeof(float)));
-    glEnableVertexAttribArray(0);
-    // glEnableVertexAttribArray(1);
-    glEnableVertexAttribArray(2);
-    mesh->vertexCount = static_cast<unsigned>(vertices.size());
+    // Only position and uv is used by the screen quad
+    EM.emplace<component::mesh>(entity, GeometryBuffer::get().add(vertices, {}, vertexformat::makeLayout({
+        {vertexformat::semantic::POSITION, vertexformat::encoding::FLOAT3},
+        {vertexformat::semantic::UV, vertexformat::encoding::FLOAT2}
+    })));
 
 
 
@@ -384,8 +820,9 @@ void App::setupScene()
     }});
     EM.emplace<component::metadata>(entity, "player");
     auto &camera = EM.emplace<component::camera>(entity);
-    int width, height;
-    glfwGetFramebufferSize(wp, &width, &height);
+    int width{static_cast<int>(SCR_WIDTH)}, height{static_cast<int>(SCR_HEIGHT)};
+    if (wp != nullptr)
+        glfwGetFramebufferSize(wp, &width, &height);
     /**
      * glm::perspective makes a right hand coordinate system,
      * meaning that x is right, y is up and negative z is forward.
@@ -401,34 +838,17 @@ void App::setupScene()
     entity = EM.create();
     EM.emplace<component::mat>(entity, axisShader.get());
     EM.emplace<component::metadata>(entity, "axis");
-    mesh = &EM.emplace<component::mesh>(entity);
     // EM.emplace<component::trans>(entity);
+    EM.emplace<component::mesh>(entity, GeometryBuffer::get().add({shapes::axis.begin(), shapes::axis.end()}, {}, vertexformat::floats(), GL_LINES));
 
-    unsigned int VAO, VBO, EBO;
-    glGenVertexArrays(1, &mesh->VAO);
-    glBindVertexArray(mesh->VAO);
-
-    glGenBuffers(1, &mesh->VBO);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh->VBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(shapes::axis), shapes::axis.data(), GL_STATIC_DRAW);
-
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), nullptr);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), (void *)(3 * sizeof(float)));
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(vertex), (void *)(6 * sizeof(float)));
-    glEnableVertexAttribArray(0);
-    glEnableVertexAttribArray(1);
-    glEnableVertexAttribArray(2);
-
-    mesh->vertexCount = static_cast<unsigned int>(shapes::axis.size());
-    mesh->drawMode = GL_LINES;
 
 
 
+    ModelLoader::get().vertexFormat = MESH_VERTEX_FORMAT;
 
     // ----------- Cube: ------------------------------
     auto cubeEnt = entity = EM.create();
     EM.emplace<component::mat>(entity, uvColorShader.get());
-    mesh = &EM.emplace<component::mesh>(entity);
     EM.emplace<component::trans>(entity);
     EM.emplace<component::metadata>(entity, "cube");
     // set up vertex data (and buffer(s)) and configure vertex attributes
@@ -445,39 +865,12 @@ void App::setupScene()
     // std::cout << "Vertex count: " << obj.first.size() << ", index count: " << obj.second.size() << std::endl;
 
 
-    glGenVertexArrays(1, &mesh->VAO);
-    glGenBuffers(1, &mesh->VBO);
-    glGenBuffers(1, &mesh->IBO);
-    // bind the Vertex Array Object first, then bind and set vertex buffer(s), and then configure vertex attributes(s).
-    glBindVertexArray(mesh->VAO);
-
-    glBindBuffer(GL_ARRAY_BUFFER, mesh->VBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(shapes::cube), shapes::cube.data(), GL_STATIC_DRAW);
-
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->IBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(shapes::cubeIndices), shapes::cubeIndices.data(), GL_STATIC_DRAW);
-    // GLint bufferSize;
-    // glGetBufferParameteriv(GL_ELEMENT_ARRAY_BUFFER, GL_BUFFER_SIZE, &bufferSize);
-    // std::cout << "buffer size: " << bufferSize << std::endl;
-
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), (void *)0);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), (void *)(3 * sizeof(float)));
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(vertex), (void *)(6 * sizeof(float)));
-    glEnableVertexAttribArray(0);
-    glEnableVertexAttribArray(1);
-    glEnableVertexAttribArray(2);
-
-    mesh->vertexCount = static_cast<unsigned int>(shapes::cube.size());
-    mesh->bIndices = true;
-    // std::tuple_size to get length of array. Surprisingly that it doesn't already exist in std::array
-    // https://stackoverflow.com/questions/21936507/why-isnt-stdarraysize-static
-    mesh->indexCount = static_cast<unsigned int>(shapes::cubeIndices.size());
-
-    // // note that this is allowed, the call to glVertexAttribPointer registered VBO as the vertex attribute's bound vertex buffer object so afterwards we can safely unbind
-    // glBindBuffer(GL_ARRAY_BUFFER, 0);
+    meshproc::container cubeObj{{shapes::cube.begin(), shapes::cube.end()}, {shapes::cubeIndices.begin(), shapes::cubeIndices.end()}};
+    std::cout << "Mesh cube: " << meshproc::optimize(cubeObj) << std::endl;
 
-    // remember: do NOT unbind the EBO while a VAO is active as the bound element buffer object IS stored in the VAO; keep the EBO bound.
-    //glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    auto layout = vertexformat::select(MESH_VERTEX_FORMAT, cubeObj.first);
+    std::cout << "Vertex format cube: " << vertexformat::validate(cubeObj.first, layout) << std::endl;
+    EM.emplace<component::mesh>(entity, GeometryBuffer::get().add(cubeObj.first, cubeObj.second, layout));
 
 
 
@@ -489,21 +882,14 @@ void App::setupScene()
     // EM.emplace<component::mat>(entity, phongShader.get(), glm::vec3{0.7f, 0.2f, 0.2f});
     EM.emplace<component::trans>(entity) = {.pos{0.f, -1.f, 0.f}, .scale{2.f}};
     EM.emplace<component::metadata>(entity, "plane");
-    mesh = &EM.emplace<component::mesh>(entity);
-    glCreateVertexArrays(1, &mesh->VAO);
-    glBindVertexArray(mesh->VAO);
-    
-    glCreateBuffers(1, &mesh->VBO);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh->VBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(shapes::plane), shapes::plane.data(), GL_STATIC_DRAW);
-    mesh->vertexCount = static_cast<unsigned int>(shapes::plane.size());
 
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), (void *)0);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), (void *)(3 * sizeof(float)));
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(vertex), (void *)(6 * sizeof(float)));
-    glEnableVertexAttribArray(0);
-    glEnableVertexAttribArray(1);
-    glEnableVertexAttribArray(2);
+    auto planeObj = meshproc::weld({shapes::plane.begin(), shapes::plane.end()});
+    std::cout << "Mesh plane: " << meshproc::optimize(planeObj) << std::endl;
+
+    layout = vertexformat::select(MESH_VERTEX_FORMAT, planeObj.first);
+    std::cout << "Vertex format plane: " << vertexformat::validate(planeObj.first, layout) << std::endl;
+    EM.emplace<component::mesh>(entity, GeometryBuffer::get().add(planeObj.first, planeObj.second, layout));
+
 
 
 
@@ -517,28 +903,25 @@ void App::setupScene()
     EM.emplace<component::trans>(entity, component::trans{.scale{10.f, 10.f, 10.f}});
     EM.emplace<component::metadata>(entity, "ball");
     EM.emplace<component::phys>(entity, component::phys{.mass{1000000000.f}, .bStatic{true}});
-    mesh = &EM.emplace<component::mesh>(entity);
-    glCreateVertexArrays(1, &mesh->VAO);
-    glBindVertexArray(mesh->VAO);
-
-    glCreateBuffers(1, &mesh->VBO);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh->VBO);
-    auto ballVertices = shapes::cubeSphere(3);
-    // Have to use ballvertice.size() * sizeof(vertex) because it's a std::vector
-    glBufferData(GL_ARRAY_BUFFER, ballVertices.size() * sizeof(vertex), ballVertices.data(), GL_STATIC_DRAW);
-    mesh->vertexCount = static_cast<unsigned int>(ballVertices.size());
-    mesh->drawMode = GL_TRIANGLES;
-    mesh->bIndices = false;
-    
-
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), (void *)0);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), (void *)(3 * sizeof(float)));
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(vertex), (void *)(6 * sizeof(float)));
-    glEnableVertexAttribArray(0);
-    glEnableVertexAttribArray(1);
-    glEnableVertexAttribArray(2);
-
-    sphereMesh = *mesh;
+    // Lights every planet without fading
+    EM.emplace<component::light>(entity);
+    // Sphere levels of detail, from a full screen sun down to pinpoint planets
+    std::vector<meshproc::container> sphereLevels{};
+    for (unsigned int subdivisions : {4u, 3u, 2u, 1u, 0u}) {
+        meshproc::stats stats{};
+        sphereLevels.push_back(meshproc::optimized(shapes::cubeSphere(subdivisions), &stats));
+        std::cout << "Mesh sphere (" << subdivisions << " subdivisions): " << stats << std::endl;
+        std::cout << "Vertex format sphere (" << subdivisions << " subdivisions): "
+            << vertexformat::validate(sphereLevels.back().first, vertexformat::select(MESH_VERTEX_FORMAT, sphereLevels.back().first)) << std::endl;
+    }
+    sphereLods = LodSet{sphereLevels, {250.f, 60.f, 15.f, 4.f, 0.f}, MESH_VERTEX_FORMAT};
+    // Occluders are drawn with the 2 subdivision sphere, whose corners lie on the unit sphere
+    std::vector<glm::vec3> occluderPositions{};
+    for (const auto& v : sphereLevels[2].first)
+        occluderPositions.push_back(v.pos);
+    occlusion.setOccluderMesh(std::move(occluderPositions), sphereLevels[2].second);
+    EM.emplace<component::mesh>(entity, sphereLods.mesh(0));
+    EM.emplace<component::lod>(entity);
 
 
 
@@ -559,9 +942,11 @@ void App::setupScene()
         float vol = 12.57f * std::powf(radius, 3.f) / 3.f;
         return 10000.f * vol;
     };
+    std::vector<entt::entity> planets{};
     for (unsigned int i{0}, max{30}; i < max; ++i)
     {
         entity = EM.create();
+        planets.push_back(entity);
         EM.emplace<component::mat>(entity, phongShader.get(), getRandColor());
         auto &trans = EM.emplace<component::trans>(entity);
         auto deg = getRandDeg();
@@ -573,18 +958,92 @@ void App::setupScene()
         // std::cout << "Startpos: " << trans.pos.x << ", " << trans.pos.y << ", " << trans.pos.z << std::endl;
         trans.rot = glm::quat{std::cosf(deg * 0.5f), dir * std::sinf(deg * 0.5f)};
         trans.scale = glm::vec3{std::rand() % 40 * 0.1f};
-        // Copy the mesh component (use same VAO)
+        // Copy the mesh component (same geometry)
         EM.emplace<component::mesh>(entity, EM.get<component::mesh>(sphereEnt));
+        EM.emplace<component::lod>(entity);
         EM.emplace<component::metadata>(entity, std::string{"plane "}.append(std::to_string(i)));
         EM.emplace<component::phys>(entity, getMassFromSize(trans), velDir * (std::rand() % 100 * 0.01f));
         EM.emplace<component::particle>(entity);
     }
 
-    particles = std::make_unique<Particles<30, PARTICLE_TRAIL_SIZE>>();
+    particles = std::make_unique<Particles<30, PARTICLE_TRAIL_SIZE>>(MESH_VERTEX_FORMAT, bGpuTrails);
+
+    // Moons around the larger planets, placed in their planet's space through the transform hierarchy
+    unsigned int moonCount{0};
+    for (auto planet : planets)
+    {
+        if (MOON_COUNT <= moonCount || EM.get<component::trans>(planet).scale.x < 1.f)
+            continue;
+
+        // Pivot in the planet's center swinging the moon around
+        auto pivot = EM.create();
+        EM.emplace<component::trans>(pivot);
+        EM.emplace<component::spin>(pivot, glm::normalize(glm::cross(glm::vec3{1.f, 0.f, 0.f}, getRandPointInUnitSphere())), 0.5f + std::rand() % 100 * 0.01f);
+        transforms.setParent(EM, pivot, planet);
+
+        entity = EM.create();
+        EM.emplace<component::mat>(entity, phongShader.get(), getRandColor());
+        // Relative to the planet, which has radius 1 in its own space
+        EM.emplace<component::trans>(entity, component::trans{.pos{2.5f, 0.f, 0.f}, .scale{glm::vec3{0.3f}}, .flags{component::trans::SPHERE}});
+        EM.emplace<component::mesh>(entity, EM.get<component::mesh>(sphereEnt));
+        EM.emplace<component::lod>(entity);
+        EM.emplace<component::metadata>(entity, std::string{"moon "}.append(std::to_string(moonCount++)));
+        transforms.setParent(EM, entity, pivot);
+    }
+    // Stars scattered around the system, each lighting the planets close to it
+    for (unsigned int i{0}; i < STAR_COUNT; ++i)
+    {
+        const auto dir = getRandPointInUnitSphere();
+        const auto distance = std::rand() % 100 * 1.5f + 60.f;
+        const auto color = glm::mix(glm::vec3{1.f, 0.5f, 0.2f}, glm::vec3{0.8f, 0.9f, 1.f}, std::rand() % 100 * 0.01f);
+
+        entity = EM.create();
+        EM.emplace<component::mat>(entity, sunShader.get(), color);
+        EM.emplace<component::trans>(entity, component::trans{.pos{dir * distance}, .scale{glm::vec3{0.5f}}, .flags{component::trans::SPHERE}});
+        EM.emplace<component::mesh>(entity, EM.get<component::mesh>(sphereEnt));
+        EM.emplace<component::lod>(entity);
+        EM.emplace<component::metadata>(entity, std::string{"star "}.append(std::to_string(i)));
+        EM.emplace<component::light>(entity, color, STAR_LIGHT_RADIUS);
+    }
+    lightClusters = std::make_unique<LightClusters>();
+
+    // GPU culling reads the world matrices
+    transforms.update(EM);
+
+    // Same spheres, culled and drawn by the GPU
+    Shader indirectSunShader{"src/shaders/indirect.vert", "src/shaders/sun.frag", {meshFormat}};
+    Shader indirectPhongShader{"src/shaders/indirect.vert", "src/shaders/phong.frag", {meshFormat}};
+    gpuCulling = std::make_unique<GpuCulling>(sphereLods, FRAMES_IN_FLIGHT);
+    gpuCulling->build(EM, {{sunShader.get(), indirectSunShader.get()}, {phongShader.get(), indirectPhongShader.get()}});
+
+    // Same spheres again, as ray cast quads
+    Shader sunImpostorShader{"src/shaders/impostor.vert", "src/shaders/sunimpostor.frag"};
+    Shader phongImpostorShader{"src/shaders/impostor.vert", "src/shaders/phongimpostor.frag"};
+    impostors = std::make_unique<SphereImpostors>(std::vector<std::pair<unsigned int, unsigned int>>{
+        {sunShader.get(), sunImpostorShader.get()}, {phongShader.get(), phongImpostorShader.get()}
+    });
+
+    defragmentGeometry();
+    std::cout << "Geometry: " << GeometryBuffer::get().getStats() << std::endl;
 
     // You can unbind the VAO afterwards so other VAO calls won't accidentally modify this VAO, but this rarely happens. Modifying other
     // VAOs requires a call to glBindVertexArray anyways so we generally don't unbind VAOs (nor VBOs) when it's not directly necessary.
     glBindVertexArray(0);
+    // Setting up the scene bound objects directly, so start tracking from scratch
+    GLState::get().invalidate();
+}
+
+void App::defragmentGeometry()
+{
+    if (GeometryBuffer::get().defragment() == 0)
+        return;
+
+    // Every copy of a mesh holds its own offsets
+    EM.view<component::mesh>().each([](auto entity, component::mesh& mesh) {
+        GeometryBuffer::get().update(mesh);
+    });
+    sphereLods.update();
+    gpuCulling->update(sphereLods);
 }
 
 void App::cleanupScene()
@@ -592,22 +1051,33 @@ void App::cleanupScene()
     auto view = EM.view<component::mesh>();
     for (auto entity : view)
     {
-        auto &mesh = view.get<component::mesh>(entity);
+        // Level of detail meshes are owned by their LodSet
+        if (EM.has<component::lod>(entity))
+            continue;
 
-        if (mesh.bIndices)
-            glDeleteBuffers(1, &mesh.IBO);
-        
-        glDeleteBuffers(1, &mesh.VBO);
-        glDeleteVertexArrays(1, &mesh.VAO);
+        GeometryBuffer::get().remove(view.get<component::mesh>(entity));
     }
+
+    sphereLods.deInit();
+    gpuCulling.reset();
+    impostors.reset();
+    lightClusters.reset();
+    frameCapture.reset();
+    dynamicResolution.reset();
+    framePacer.reset();
+    renderGraph.reset();
+    uploadRing.reset();
+    GeometryBuffer::get().clear();
+    Tracer::get().deInit();
+    GpuMemory::get().deleteTextures(1, &frameGraphTex);
 }
 
 void App::framebuffer_size_callback(GLFWwindow *wp, int width, int height)
 {
     // make sure the viewport matches the new wp dimensions; note that width and
     // height will be significantly larger than specified on retina displays.
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    glViewport(0, 0, width, height);
+    GLState::get().bindFramebuffer(GL_FRAMEBUFFER, 0);
+    GLState::get().viewport(0, 0, width, height);
 
     auto app = static_cast<App *>(glfwGetWindowUserPointer(wp));
     assert(app != nullptr);
@@ -622,9 +1092,10 @@ void App::framebuffer_size_callback(GLFWwindow *wp, int width, int height)
          */
     camera.proj = glm::perspective(glm::radians(camera.FOV), static_cast<float>(width) / height, SCR_NEAR, SCR_FAR);
 
-    app->bloomEffect.reset(new Bloom{std::move(*app->bloomEffect), width, height});
+    // The render graph reallocates the targets once, on the next frame
+    app->bloomEffect->resize(width, height);
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    GLState::get().bindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
 void App::errorCallback(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar *message, const void *userParam)
@@ -655,7 +1126,8 @@ void App::errorCallback(GLenum source, GLenum type, GLuint id, GLenum severity,
     // Close if severe error.
     if (severity == GL_DEBUG_SEVERITY_HIGH) {
         auto app = (App*)userParam;
-        glfwSetWindowShouldClose(app->wp, true);
+        if (app->wp != nullptr)
+            glfwSetWindowShouldClose(app->wp, true);
     }
 
     std::cout << "GL_ERROR: (source: " << sourceStr << ", type: " << typeStr << ", severity: " << severityStr << ", message: " << message << std::endl;
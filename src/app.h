@@ -16,6 +16,26 @@
 #include "components.h"
 #include "bloom.h"
 #include "particles.h"
+#include "lod.h"
+#include "vertexformat.h"
+#include "uploadring.h"
+#include "gpuculling.h"
+#include "trace.h"
+#include "framestats.h"
+#include "headless.h"
+#include "transformhierarchy.h"
+#include "drawlist.h"
+#include "occlusion.h"
+#include "lightclusters.h"
+#include "glstate.h"
+#include "framedamage.h"
+#include "framecapture.h"
+#include "gpumemory.h"
+#include "impostors.h"
+#include "dynamicresolution.h"
+#include "framepacer.h"
+#include "rendergraph.h"
+#include <string>
 
 // settings
 const unsigned int SCR_WIDTH = 800;
@@ -24,6 +44,65 @@ const float SCR_NEAR = 1.f;
 const float SCR_FAR = 1000.f;
 const float CAMERA_ROTATION_SPEED = 0.1f;
 constexpr unsigned int PARTICLE_TRAIL_SIZE = 100;
+// Moons orbiting the larger planets (see transformhierarchy.h)
+constexpr unsigned int MOON_COUNT = 5;
+// Small stars scattered around the system, each a light source (see lightclusters.h)
+constexpr unsigned int STAR_COUNT = 48;
+constexpr float STAR_LIGHT_RADIUS = 80.f;
+// Vertex layout used for scene meshes (see vertexformat.h)
+constexpr vertexformat::preset MESH_VERTEX_FORMAT = vertexformat::preset::PACKED;
+// Frames the CPU may write ahead of the GPU (see uploadring.h)
+constexpr unsigned int FRAMES_IN_FLIGHT = 3;
+constexpr long UPLOAD_RING_FRAME_SIZE = 256 * 1024;
+// Must match the binding of the Camera block in src/shaders/camera.vert
+constexpr unsigned int CAMERA_UBO_BINDING = 0;
+// Cull and draw the spheres with a compute pass and multi draw indirect (toggled with G)
+constexpr bool GPU_CULLING = true;
+// Draw the spheres as ray cast quads instead of meshes (toggled with I, see impostors.h)
+constexpr bool SPHERE_IMPOSTORS = true;
+// Append particle trail samples with a compute pass instead of on the CPU, trail spheres
+// are then not occlusion culled (toggled with T, see particles.h)
+constexpr bool GPU_TRAILS = true;
+// Skip spheres hidden behind large occluders, tested on the CPU (toggled with O, see occlusion.h)
+constexpr bool OCCLUSION_CULLING = true;
+// Besides static bodies, spheres at least this large on screen (radius in pixels) occlude others
+constexpr float OCCLUDER_SCREEN_RADIUS = 60.f;
+// Written when pressing F12, open in chrome://tracing or ui.perfetto.dev
+constexpr auto TRACE_FILE = "trace.json";
+// Frame times of the last frames, written when pressing F2 (see framestats.h)
+constexpr auto FRAME_STATS_FILE = "framestats.csv";
+// Warns when buffers, textures and renderbuffers use more, the breakdown is printed with F4 (see gpumemory.h)
+constexpr long long GPU_MEMORY_BUDGET = 256ll * 1024 * 1024;
+// Image sequence written while capturing is toggled with F3 (see framecapture.h)
+constexpr auto CAPTURE_PREFIX = "capture";
+// Blur used for bloom, picked with --bloom gaussian|dual|compute and cycled with B (see Bloom::method)
+constexpr Bloom::method BLOOM_METHOD = Bloom::method::DUAL_FILTER;
+// Frame time drawn as a line in the frame graph (toggled with F1)
+constexpr float TARGET_FRAME_MS = 1000.f / 60.f;
+// Lower the render resolution and bloom quality to hold TARGET_FRAME_MS on the GPU (toggled with R, see dynamicresolution.h)
+constexpr bool DYNAMIC_RESOLUTION = true;
+// Sample mouse look right before the scene is submitted, after waiting until fewer than
+// LOW_LATENCY_QUEUED frames are left on the GPU (toggled with L, see framepacer.h)
+constexpr bool LOW_LATENCY = false;
+constexpr unsigned int LOW_LATENCY_QUEUED = 1;
+// Only render frames where something changed, otherwise keep the last one on screen (see framedamage.h)
+constexpr bool SKIP_IDLE_FRAMES = true;
+// Rate input is polled at while no frames are rendered
+constexpr double IDLE_FPS = 10.0;
+// Simulation step of every headless frame, keeps headless runs reproducible
+constexpr float HEADLESS_TIMESTEP = 1.f / 60.f;
+
+// Command line options, see main.cpp
+struct AppOptions
+{
+    // Frames to render without a window, 0 opens a window
+    unsigned int headlessFrames{0};
+    // Image (.ppm) written after the last headless frame
+    std::string imageFile{};
+    // Captures every frame to <prefix>_00000.ppm, ... when set
+    std::string capturePrefix{};
+    Bloom::method bloomMethod{BLOOM_METHOD};
+};
 
 class App
 {
@@ -32,9 +111,14 @@ private:
     Timer appTimer{};
     Timer frameTimer{};
     GLFWwindow *wp{nullptr};
+    AppOptions options;
+    // Replaces the window when running headless
+    std::unique_ptr<HeadlessContext> headless;
     entt::entity screenSpacedQuad;
     unsigned int screenSpaceVAO, screenSpaceVBO;
     std::unique_ptr<Bloom> bloomEffect;
+    // Runs the frame's passes and pools their targets
+    std::unique_ptr<RenderGraph> renderGraph;
     float cameraSpeed{1.f};
 
     // Entity Manager
@@ -46,27 +130,80 @@ private:
     float timeDilation{1.f};
     bool bPause{false};
     bool bSpacePressed{false};
+    bool bGpuCulling{GPU_CULLING};
+    bool bGPressed{false};
+    bool bImpostors{SPHERE_IMPOSTORS};
+    bool bIPressed{false};
+    bool bOcclusionCulling{OCCLUSION_CULLING};
+    bool bOPressed{false};
+    bool bGpuTrails{GPU_TRAILS};
+    bool bTPressed{false};
+    bool bTracePressed{false};
+    bool bShowFrameStats{false};
+    bool bFrameStatsPressed{false};
+    bool bCsvPressed{false};
+    bool bCapturePressed{false};
+    bool bMemoryPressed{false};
+    bool bRPressed{false};
+    bool bLowLatency{LOW_LATENCY};
+    bool bLPressed{false};
+    bool bBPressed{false};
     glm::ivec2 screenSize{SCR_WIDTH, SCR_HEIGHT};
 
-    component::mesh sphereMesh;
+    // Sphere meshes for sun, planets and trails, picked by projected size
+    LodSet sphereLods;
+    unsigned int trailLod{0};
+    // Triangles submitted during the last frame
+    unsigned int trianglesSubmitted{0};
     std::unique_ptr<Particles<30, PARTICLE_TRAIL_SIZE>> particles;
+    // Camera matrices and particle data, rewritten every frame
+    std::unique_ptr<UploadRing> uploadRing;
+    std::unique_ptr<GpuCulling> gpuCulling;
+    std::unique_ptr<SphereImpostors> impostors;
+    std::unique_ptr<LightClusters> lightClusters;
+    FrameStats frameStats{};
+    TransformHierarchy transforms{};
+    DrawList drawList{};
+    // Entities considered for drawList this frame
+    std::vector<entt::entity> drawEntities;
+    OcclusionBuffer occlusion{};
+    FrameDamage damage{};
+    // Reads back the final image of every frame while recording
+    std::unique_ptr<FrameCapture> frameCapture;
+    // Frames in the image sequence of earlier recordings
+    unsigned long long capturedFrames{0};
+    // Picks the render size while enabled, otherwise the scene is rendered at the window size
+    std::unique_ptr<DynamicResolution> dynamicResolution;
+    // Limits queued frames and measures input latency, only with a window
+    std::unique_ptr<FramePacer> framePacer;
+    // Frame times drawn by ui.frag
+    unsigned int frameGraphTex{0};
 
 
 
     int initGLFW();
+    int initHeadless();
     int initOpenGL();    
     void showFPS();
+    void drawFrameStats();
     // process all input: query GLFW whether relevant keys are pressed/released this frame and react accordingly
     void processInput(float deltaTime = 1.f);
+    // Turns the camera by the cursor movement since the last call while looking around
+    void mouseLook(float deltaTime);
+    // Draws the scene into the renderSize corner of framebuffer
+    void renderScene(unsigned int framebuffer, const glm::ivec2& renderSize);
     void gameloop();
 
 public:
-    App();
+    App(AppOptions appOptions = {});
     
     // Recursive init function that uses rewards to calculate progress
     int init(int currentReward = 0);
     int exec();
+    int execHeadless();
     void setupScene();
+    // Compacts the geometry arenas and updates every mesh referencing them
+    void defragmentGeometry();
     void cleanupScene();
 
 
@@ -78,6 +215,10 @@ public:
     static void scroll_callback(GLFWwindow *wp, double xoffset, double yoffset) {
         static_cast<App*>(glfwGetWindowUserPointer(wp))->mouseWheelDist += yoffset;
     }
+    // The window has to be repainted, like after being uncovered
+    static void refresh_callback(GLFWwindow *wp) {
+        static_cast<App*>(glfwGetWindowUserPointer(wp))->damage.damage();
+    }
 
 
 
@@ -111,7 +252,7 @@ public:
  */
 class AppSingleton
 {
-    friend App::App();
+    friend App::App(AppOptions);
 private:
     std::vector<App*> Instances;
     AppSingleton() = default;
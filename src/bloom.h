@@ -4,22 +4,61 @@
 #include <glad/glad.h>
 #include "shader.h"
 #include "components.h"
+#include "glstate.h"
+#include "gpumemory.h"
+#include "rendergraph.h"
 #include <vector>
 #include <memory>
 #include <optional>
+#include <algorithm>
 
 
+/**
+ * Adds the bloom passes to a render graph, which owns the targets (see rendergraph.h).
+ * The scene is rendered into a window sized target, but may only use its lower left
+ * renderWidth x renderHeight corner (see setRenderSize()). The blur runs at a fraction of
+ * that and the combine pass upscales both to the whole output.
+ */
 class Bloom {
+public:
+    // How the bright parts are blurred
+    enum class method {
+        // Separable Gaussian passes ping-ponging at the blur resolution
+        GAUSSIAN,
+        // Downsampled through a pyramid and upsampled back with a tent filter (dual Kawase)
+        DUAL_FILTER,
+        // Compute shaders, bright pass fused with the downsample and a shared memory Gaussian
+        COMPUTE
+    };
+
+    static const char* methodName(method m) {
+        switch (m) {
+            case method::DUAL_FILTER: return "dual filter";
+            case method::COMPUTE: return "compute";
+            default: return "gaussian";
+        }
+    }
+
 private:
+    using resource = RenderGraph::resource;
+
     GLsizei width, height;
-    static constexpr unsigned int blurBufferDivisor = 2;
+    // Smallest blur divisor, the blur targets are sized for it
+    static constexpr unsigned int minBlurDivisor = 2;
+
+    GLsizei renderWidth, renderHeight;
+    unsigned int blurBufferDivisor{minBlurDivisor};
+
+    // Framebuffer the final image is combined into, 0 is the window
+    unsigned int outputBuf{0};
 
-    unsigned int inputBuf, iTex, iDepth;
-    unsigned int base;
-    unsigned int bTex[2], bDepth[2];
-    unsigned int pingpong[2];
-    unsigned int ppTex[2];
-    unsigned lastPing = 0;
+    method blurMethod{method::GAUSSIAN};
+    // Passes of blur(), an even count ends in the target it started from
+    static constexpr unsigned int blurPasses = 10;
+    // Pyramid levels below the blur targets, each half the size of the one above
+    static constexpr unsigned int dualLevels = 4;
+    // Pixels per workgroup of bloomblur.comp
+    static constexpr int computeTile = 128;
 
     std::optional<unsigned> q, qVBO;
 
@@ -42,7 +81,7 @@ private:
             {.pos{-1.f, 1.f, 0.f}, .uv{0.f, 1.f}},
             {.pos{-1.f, -1.f, 0.f}, .uv{0.f, 0.f}}
         };
-        glBufferData(GL_ARRAY_BUFFER, sizeof(vertex) * vertices.size(), vertices.data(), GL_STATIC_DRAW);
+        GpuMemory::get().bufferData("Bloom", *qVBO, sizeof(vertex) * vertices.size(), vertices.data(), GL_STATIC_DRAW);
         glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), nullptr);
         // glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), (void *)(3 * sizeof(float)));
         glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(vertex), (void *)(6 * sizeof(float)));
@@ -55,201 +94,279 @@ private:
         glDrawArrays(GL_TRIANGLES, 0, 6);
     }
 
-    void initBuffers() {
-        glGenFramebuffers(1, &inputBuf);
-        glBindFramebuffer(GL_FRAMEBUFFER, inputBuf);
-        glGenTextures(1, &iTex);
-        glBindTexture(GL_TEXTURE_2D, iTex);
-        glViewport(0, 0, width, height);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_FLOAT, nullptr);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, iTex, 0);
-
-        glGenRenderbuffers(1, &iDepth);
-        glBindRenderbuffer(GL_RENDERBUFFER, iDepth);
-        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
-        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, iDepth);
-
-        if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
-            std::cout << "Framebuffer failed with status: " << glCheckFramebufferStatus(GL_FRAMEBUFFER) << std::endl;
-            return;
-        }
+    GLsizei blurWidth(unsigned int divisor) const { return std::max(width / static_cast<GLsizei>(divisor), 1); }
+    GLsizei blurHeight(unsigned int divisor) const { return std::max(height / static_cast<GLsizei>(divisor), 1); }
+    GLsizei blurRenderWidth() const { return std::max(renderWidth / static_cast<GLsizei>(blurBufferDivisor), 1); }
+    GLsizei blurRenderHeight() const { return std::max(renderHeight / static_cast<GLsizei>(blurBufferDivisor), 1); }
+    GLsizei dualWidth(unsigned int level) const { return std::max(blurWidth(minBlurDivisor) >> (level + 1), 1); }
+    GLsizei dualHeight(unsigned int level) const { return std::max(blurHeight(minBlurDivisor) >> (level + 1), 1); }
+    GLsizei dualRenderWidth(unsigned int level) const { return std::max(blurRenderWidth() >> (level + 1), 1); }
+    GLsizei dualRenderHeight(unsigned int level) const { return std::max(blurRenderHeight() >> (level + 1), 1); }
+
+    RenderGraph::targetDesc blurDesc() const { return {GL_RGBA16F, blurWidth(minBlurDivisor), blurHeight(minBlurDivisor)}; }
+    RenderGraph::targetDesc dualDesc(unsigned int level) const { return {GL_RGBA16F, dualWidth(level), dualHeight(level)}; }
+
+    /**
+     * Draws the srcWidth x srcHeight corner of src (a texWidth x texHeight texture)
+     * into the dstWidth x dstHeight corner of framebuffer with shader.
+     */
+    void filterPass(unsigned int shader, unsigned int src, GLsizei srcWidth, GLsizei srcHeight, GLsizei texWidth, GLsizei texHeight,
+        unsigned int framebuffer, GLsizei dstWidth, GLsizei dstHeight) {
+        auto& state = GLState::get();
+        state.bindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        state.viewport(0, 0, dstWidth, dstHeight);
+        state.disable(GL_DEPTH_TEST);
+        state.bindVertexArray(*q);
+        state.useProgram(shader);
+        glUniform2f(glGetUniformLocation(shader, "uvScale"), static_cast<float>(srcWidth) / texWidth, static_cast<float>(srcHeight) / texHeight);
+        state.bindTexture(0, src);
+        render();
+    }
 
+    // Extracts the bright parts of scene into a full size target and downsamples them into a blur target
+    resource split(RenderGraph& graph, resource scene) {
+        const auto bright = graph.create({GL_RGBA16F, width, height});
+        const auto blurred = graph.create(blurDesc());
+        graph.addPass("Bloom::split", {scene}, {bright, blurred}, [=, this](RenderGraph& g) {
+            auto& state = GLState::get();
+            state.bindFramebuffer(GL_FRAMEBUFFER, g.framebuffer(bright));
+            state.viewport(0, 0, renderWidth, renderHeight);
+            state.disable(GL_DEPTH_TEST);
+            glClear(GL_COLOR_BUFFER_BIT);
+            state.useProgram(splitShader->get());
+            glUniform2f(glGetUniformLocation(splitShader->get(), "uvScale"), static_cast<float>(renderWidth) / width, static_cast<float>(renderHeight) / height);
+            state.bindVertexArray(*q);
+            state.bindTexture(0, g.texture(scene));
 
+            render();
 
-        glGenFramebuffers(1, &base);
-        glBindFramebuffer(GL_FRAMEBUFFER, base);
-        glViewport(0, 0, width, height);
-        glGenTextures(2, bTex);
-        for (unsigned int i{0}; i < 2; ++i) {
-            glBindTexture(GL_TEXTURE_2D, bTex[i]);
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_FLOAT, nullptr);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            state.bindFramebuffer(GL_READ_FRAMEBUFFER, g.framebuffer(bright));
+            state.bindFramebuffer(GL_DRAW_FRAMEBUFFER, g.framebuffer(blurred));
+            glBlitFramebuffer(0, 0, renderWidth, renderHeight, 0, 0, blurRenderWidth(), blurRenderHeight(), GL_COLOR_BUFFER_BIT, GL_LINEAR);
+        });
+        return blurred;
+    }
 
-            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, bTex[i], 0);
-        }
-        unsigned attachments[]{ GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
-        glDrawBuffers(2, attachments);
+    // Ping-pongs between src and a second target, returns the one holding the result
+    resource blur(RenderGraph& graph, resource src) {
+        const resource pingpong[2]{src, graph.create(blurDesc())};
+        graph.addPass("Bloom::blur", {src}, {pingpong[0], pingpong[1]}, [=, this](RenderGraph& g) {
+            auto& state = GLState::get();
+            state.bindVertexArray(*q);
+            state.useProgram(blurShader->get());
+            state.viewport(0, 0, blurRenderWidth(), blurRenderHeight());
+            state.disable(GL_DEPTH_TEST);
+            // Only the corner written by split() is blurred
+            glUniform2f(glGetUniformLocation(blurShader->get(), "uvScale"),
+                static_cast<float>(blurRenderWidth()) / blurWidth(minBlurDivisor), static_cast<float>(blurRenderHeight()) / blurHeight(minBlurDivisor));
+            bool horizontal{false};
+            for (unsigned int i{0}; i < blurPasses; ++i) {
+                state.bindFramebuffer(GL_FRAMEBUFFER, g.framebuffer(pingpong[!horizontal]));
+                glClear(GL_COLOR_BUFFER_BIT);
+                glUniform1i(glGetUniformLocation(blurShader->get(), "horizontal"), horizontal);
+                state.bindTexture(0, g.texture(pingpong[horizontal]));
+                horizontal = !horizontal;
+
+                render();
+            }
+        });
+        return pingpong[blurPasses % 2];
+    }
 
-        if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
-            std::cout << "Framebuffer failed with status: " << glCheckFramebufferStatus(GL_FRAMEBUFFER) << std::endl;
-            return;
+    /**
+     * Blurs with a few passes over ever smaller targets instead of many at one size.
+     * Each level down averages 5 bilinear taps, each level up spreads with a tent of 8,
+     * so the radius doubles per level for a fraction of the texel fetches of blur().
+     * Every level up is a new resource, which gets the target of the same level on the
+     * way down as that has been read by then.
+     */
+    resource dualFilter(RenderGraph& graph, resource src) {
+        // Down from the blur target written by split()
+        auto previous = src;
+        for (unsigned int i{0}; i < dualLevels; ++i) {
+            const auto level = graph.create(dualDesc(i));
+            graph.addPass("Bloom::down", {previous}, {level}, [=, this](RenderGraph& g) {
+                if (i == 0)
+                    filterPass(downsampleShader->get(), g.texture(previous), blurRenderWidth(), blurRenderHeight(), blurWidth(minBlurDivisor), blurHeight(minBlurDivisor),
+                        g.framebuffer(level), dualRenderWidth(0), dualRenderHeight(0));
+                else
+                    filterPass(downsampleShader->get(), g.texture(previous), dualRenderWidth(i - 1), dualRenderHeight(i - 1), dualWidth(i - 1), dualHeight(i - 1),
+                        g.framebuffer(level), dualRenderWidth(i), dualRenderHeight(i));
+            });
+            previous = level;
         }
 
-        glGenFramebuffers(2, pingpong);
-        glGenTextures(2, ppTex);
-        for (unsigned int i{0}; i < 2; ++i) {
-            glBindFramebuffer(GL_FRAMEBUFFER, pingpong[i]);
-            glViewport(0, 0, width, height);
-            glBindTexture(GL_TEXTURE_2D, ppTex[i]);
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width / blurBufferDivisor, height / blurBufferDivisor, 0, GL_RGBA, GL_FLOAT, nullptr);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-
-            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, ppTex[i], 0);
+        // and back up
+        for (unsigned int i{dualLevels - 1}; 0 < i; --i) {
+            const auto level = graph.create(dualDesc(i - 1));
+            graph.addPass("Bloom::up", {previous}, {level}, [=, this](RenderGraph& g) {
+                filterPass(upsampleShader->get(), g.texture(previous), dualRenderWidth(i), dualRenderHeight(i), dualWidth(i), dualHeight(i),
+                    g.framebuffer(level), dualRenderWidth(i - 1), dualRenderHeight(i - 1));
+            });
+            previous = level;
         }
+        const auto blurred = graph.create(blurDesc());
+        graph.addPass("Bloom::up", {previous}, {blurred}, [=, this](RenderGraph& g) {
+            filterPass(upsampleShader->get(), g.texture(previous), dualRenderWidth(0), dualRenderHeight(0), dualWidth(0), dualHeight(0),
+                g.framebuffer(blurred), blurRenderWidth(), blurRenderHeight());
+        });
+        return blurred;
+    }
 
-        if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
-            std::cout << "Framebuffer failed with status: " << glCheckFramebufferStatus(GL_FRAMEBUFFER) << std::endl;
-            return;
+    /**
+     * Bloom without fragment passes or blits. One dispatch extracts the bright parts while
+     * box filtering the scene straight into a blur target, then a row and a column
+     * dispatch blur it as wide as blur() does, loading every texel into shared memory once.
+     */
+    resource computeBlur(RenderGraph& graph, resource scene) {
+        const auto bright = graph.create(blurDesc());
+        graph.addPass("Bloom::split", {scene}, {bright}, [=, this](RenderGraph& g) {
+            const auto s = brightComputeShader->get();
+            GLState::get().useProgram(s);
+            glUniform2i(glGetUniformLocation(s, "renderSize"), renderWidth, renderHeight);
+            glUniform1i(glGetUniformLocation(s, "divisor"), blurBufferDivisor);
+            glUniform2i(glGetUniformLocation(s, "size"), blurRenderWidth(), blurRenderHeight());
+            GLState::get().bindTexture(0, g.texture(scene));
+            glBindImageTexture(0, g.texture(bright), 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+            glDispatchCompute((blurRenderWidth() + 7) / 8, (blurRenderHeight() + 7) / 8, 1);
+            glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+        });
+
+        // Rows into a second target, then columns into a third, which gets the first one's target
+        auto previous = bright;
+        for (const bool bRows : {true, false}) {
+            const auto blurred = graph.create(blurDesc());
+            graph.addPass("Bloom::blur", {previous}, {blurred}, [=, this](RenderGraph& g) {
+                const auto s = blurComputeShader->get();
+                GLState::get().useProgram(s);
+                glUniform2i(glGetUniformLocation(s, "size"), blurRenderWidth(), blurRenderHeight());
+                glUniform2i(glGetUniformLocation(s, "direction"), bRows, !bRows);
+                GLState::get().bindTexture(0, g.texture(previous));
+                glBindImageTexture(0, g.texture(blurred), 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+                const auto length = bRows ? blurRenderWidth() : blurRenderHeight();
+                glDispatchCompute((length + computeTile - 1) / computeTile, bRows ? blurRenderHeight() : blurRenderWidth(), 1);
+                glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+            });
+            previous = blurred;
         }
+        return previous;
+    }
 
-        createQuad();
+    // Tone maps the scene with the blurred bright parts added into output
+    void combine(RenderGraph& graph, resource scene, resource blurred, resource output) {
+        graph.addPass("Bloom::combine", {scene, blurred}, {output}, [=, this](RenderGraph& g) {
+            auto& state = GLState::get();
+            state.bindFramebuffer(GL_FRAMEBUFFER, g.framebuffer(output));
+            state.viewport(0, 0, width, height);
+            state.disable(GL_DEPTH_TEST);
+            state.bindVertexArray(*q);
+            glClear(GL_COLOR_BUFFER_BIT);
+            state.useProgram(combineShader->get());
+
+            // Both are upscaled from the corners they were rendered to
+            state.bindTexture(0, g.texture(scene));
+            glUniform1i(glGetUniformLocation(combineShader->get(), "tex"), 0);
+            glUniform2f(glGetUniformLocation(combineShader->get(), "texScale"), static_cast<float>(renderWidth) / width, static_cast<float>(renderHeight) / height);
+
+            state.bindTexture(1, g.texture(blurred));
+            glUniform1i(glGetUniformLocation(combineShader->get(), "bloom"), 1);
+            glUniform2f(glGetUniformLocation(combineShader->get(), "bloomScale"),
+                static_cast<float>(blurRenderWidth()) / blurWidth(minBlurDivisor), static_cast<float>(blurRenderHeight()) / blurHeight(minBlurDivisor));
+
+            render();
+            state.bindVertexArray(0);
+        });
     }
-    
+
 public:
     std::shared_ptr<Shader> splitShader{std::make_shared<Shader>("src/shaders/postprocessing/pass.vert", "src/shaders/postprocessing/split.frag")};
     std::shared_ptr<Shader> blurShader{std::make_shared<Shader>("src/shaders/postprocessing/pass.vert", "src/shaders/postprocessing/blur.frag")};
     std::shared_ptr<Shader> combineShader{std::make_shared<Shader>("src/shaders/postprocessing/pass.vert", "src/shaders/postprocessing/combine.frag")};
+    std::shared_ptr<Shader> downsampleShader{std::make_shared<Shader>("src/shaders/postprocessing/pass.vert", "src/shaders/postprocessing/downsample.frag")};
+    std::shared_ptr<Shader> upsampleShader{std::make_shared<Shader>("src/shaders/postprocessing/pass.vert", "src/shaders/postprocessing/upsample.frag")};
+    std::shared_ptr<Shader> brightComputeShader{std::make_shared<Shader>(Shader::compute("src/shaders/postprocessing/bloomsplit.comp"))};
+    std::shared_ptr<Shader> blurComputeShader{std::make_shared<Shader>(Shader::compute("src/shaders/postprocessing/bloomblur.comp"))};
 
     // Default constructor
     Bloom(GLsizei screenWidth = 800, GLsizei screenHeight = 600)
-        : width{screenWidth}, height{screenHeight}
+        : width{screenWidth}, height{screenHeight}, renderWidth{screenWidth}, renderHeight{screenHeight}
     {
-        initBuffers();
+        createQuad();
+        // Creating the quad bound things behind the state tracker's back
+        GLState::get().invalidate();
     }
 
-    // Default copy constructor
-    Bloom(const Bloom& rhs)
-        : width{rhs.width}, height{rhs.height},
-        splitShader{rhs.splitShader}, blurShader{rhs.blurShader}, combineShader{rhs.combineShader} 
-    {
-        initBuffers();
+    Bloom(const Bloom&) = delete;
+    Bloom(Bloom&&) = delete;
+    void operator=(const Bloom&) = delete;
+    void operator=(Bloom&&) = delete;
+
+    /**
+     * Sets the output size. Nothing is reallocated here, the render graph replaces
+     * the targets on the next frame, however often this is called before it.
+     */
+    void resize(GLsizei newWidth, GLsizei newHeight) {
+        width = std::max(newWidth, 1);
+        height = std::max(newHeight, 1);
+        renderWidth = std::min(renderWidth, width);
+        renderHeight = std::min(renderHeight, height);
     }
 
-    // Copy constructor with new width and height
-    Bloom(const Bloom& rhs, GLsizei newWidth, GLsizei newHeight)
-        : width{newWidth}, height{newHeight},
-        splitShader{rhs.splitShader}, blurShader{rhs.blurShader}, combineShader{rhs.combineShader} 
-    {
-        initBuffers();
+    // Combine into another framebuffer than the window, like when rendering headless
+    void setOutput(unsigned int framebuffer) {
+        outputBuf = framebuffer;
     }
 
-    Bloom(Bloom&&) = delete;
-
-    // Custom move constructor that invalidates rhs's shader pointers and screenspaced quad.
-    Bloom(Bloom&& rhs, GLsizei newWidth, GLsizei newHeight)
-        : width{newWidth}, height{newHeight},
-        splitShader{std::move(rhs.splitShader)}, blurShader{std::move(rhs.blurShader)}, combineShader{std::move(rhs.combineShader)} 
-    {
-        q.swap(rhs.q);
-        qVBO.swap(rhs.qVBO);
-        initBuffers();
+    unsigned int output() const {
+        return outputBuf;
     }
 
-    // Initial write to buffer
-    unsigned int input() const {
-        return inputBuf;
+    /**
+     * Size the scene is rendered at in its target, at most the output size.
+     * The blur runs at renderWidth / blurDivisor x renderHeight / blurDivisor.
+     */
+    void setRenderSize(GLsizei newRenderWidth, GLsizei newRenderHeight, unsigned int blurDivisor = minBlurDivisor) {
+        renderWidth = std::clamp(newRenderWidth, 1, width);
+        renderHeight = std::clamp(newRenderHeight, 1, height);
+        blurBufferDivisor = std::max(blurDivisor, minBlurDivisor);
     }
 
-    void split() {
-        glBindFramebuffer(GL_FRAMEBUFFER, base);
-        glReadBuffer(GL_COLOR_ATTACHMENT0);
-
-        glDisable(GL_DEPTH_TEST);
-        glClear(GL_COLOR_BUFFER_BIT);
-        glUseProgram(splitShader->get());
-        glBindVertexArray(*q);
-        glBindTexture(GL_TEXTURE_2D, iTex);
-
-        render();
-
-        glBindFramebuffer(GL_READ_FRAMEBUFFER, base);
-        glReadBuffer(GL_COLOR_ATTACHMENT1);
-        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, pingpong[0]);
-        glBlitFramebuffer(0, 0, width, height, 0, 0, width / blurBufferDivisor, height / blurBufferDivisor, GL_COLOR_BUFFER_BIT, GL_LINEAR);
-        glViewport(0, 0, width / blurBufferDivisor, height / blurBufferDivisor);
+    glm::ivec2 renderSize() const {
+        return {renderWidth, renderHeight};
     }
 
-    void blur(unsigned int amount = 10) {
-        glBindVertexArray(*q);
-        glUseProgram(blurShader->get());
-        bool horizontal{false};
-        for (unsigned int i{0}; i < amount; ++i) {
-            glBindFramebuffer(GL_FRAMEBUFFER, pingpong[!horizontal]);
-            glDisable(GL_DEPTH_TEST);
-            glClear(GL_COLOR_BUFFER_BIT);
-            glUniform1i(glGetUniformLocation(blurShader->get(), "horizontal"), horizontal);
-            glBindTexture(GL_TEXTURE_2D, ppTex[horizontal]);
-            lastPing = horizontal = !horizontal;
-
-            render();
-        }
-
-        glViewport(0, 0, width, height);
-        glBlitFramebuffer(0, 0, width / blurBufferDivisor, height / blurBufferDivisor, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+    // Size of the scene target passed to addPasses()
+    glm::ivec2 size() const {
+        return {width, height};
     }
 
-    void combine() {
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-        glBindVertexArray(*q);
-        glClear(GL_COLOR_BUFFER_BIT);
-        glUseProgram(combineShader->get());
-
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, bTex[0]);
-        glUniform1i(glGetUniformLocation(combineShader->get(), "tex"), 0);
-
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, ppTex[lastPing]);
-        glUniform1i(glGetUniformLocation(combineShader->get(), "bloom"), 1);
-
-        render();
-
-        glActiveTexture(GL_TEXTURE0);
+    void setMethod(method newMethod) {
+        blurMethod = newMethod;
     }
 
-    void doTheThing() {
-        split();
-        blur();
-        combine();
+    method getMethod() const {
+        return blurMethod;
+    }
 
-        glBindVertexArray(0);
+    // Adds the passes reading scene, a size() target, and writing the final image to output()
+    void addPasses(RenderGraph& graph, resource scene) {
+        resource blurred;
+        if (blurMethod == method::COMPUTE)
+            blurred = computeBlur(graph, scene);
+        else if (blurMethod == method::DUAL_FILTER)
+            blurred = dualFilter(graph, split(graph, scene));
+        else
+            blurred = blur(graph, split(graph, scene));
+        combine(graph, scene, blurred, graph.importTarget(outputBuf));
     }
 
     ~Bloom (){
         if (q) {
-            glDeleteBuffers(1, &*qVBO);
-            glDeleteBuffers(1, &*q);
+            GpuMemory::get().deleteBuffers(1, &*qVBO);
+            glDeleteVertexArrays(1, &*q);
             q = std::nullopt;
             qVBO = std::nullopt;
         }
-
-        glDeleteTextures(2, ppTex);
-        glDeleteFramebuffers(2, pingpong);
-        glDeleteTextures(2, bTex);
-        glDeleteFramebuffers(1, &base);
-        glDeleteTextures(1, &iTex);
-        glDeleteRenderbuffers(1, &iDepth);
-        glDeleteFramebuffers(1, &inputBuf);
     }
 };
 
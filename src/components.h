@@ -5,21 +5,11 @@
 #include <glm/gtc/quaternion.hpp> // glm::quat
 #include <glm/gtc/matrix_transform.hpp>
 #include <glad/glad.h>
+#include <entt/entt.hpp> // https://github.com/skypjack/entt
 #include <type_traits>
 #include <tuple>
-#include <queue>
-
-template <class _Ty, class _Container = std::deque<_Ty>>
-class iqueue : public std::queue<_Ty, _Container> {
-public:
-    typedef typename _Container::iterator iterator;
-    typedef typename _Container::const_iterator const_iterator;
-
-    iterator begin() { return c.begin(); }
-    iterator end() { return c.end(); }
-    const_iterator begin() const { return c.begin(); }
-    const_iterator end() const { return c.end(); }
-};
+#include <cmath>
+#include <algorithm>
 
 struct vertex
 {
@@ -49,6 +39,9 @@ struct trans
     };
     unsigned char flags{};
 
+    bool operator==(const trans&) const = default;
+
+    // Local matrix, relative to the parent if the entity has one (see transformhierarchy.h)
     glm::mat4 mat() const {
         return glm::scale(glm::translate(glm::mat4{1.f}, pos), scale) * static_cast<glm::mat4>(rot);
     }
@@ -135,6 +128,47 @@ struct trans
      */
 };
 
+// Makes an entity's trans relative to another entity (see transformhierarchy.h)
+struct parent
+{
+    entt::entity entity{entt::null};
+};
+
+// World matrix cached by TransformHierarchy
+struct world
+{
+    glm::mat4 mat{1.f};
+    // The local transform and parent version mat was built from
+    trans local{};
+    // Bumped whenever mat changes, never reset so children can't mistake an old value for a new one
+    unsigned int version{0};
+    unsigned int parentVersion{0};
+    // Rebuild mat on the next update even if local and the parent are unchanged, like after reparenting
+    bool bForceRebuild{true};
+
+    glm::vec3 pos() const { return glm::vec3{mat[3]}; }
+    // Radius of a unit sphere transformed by mat
+    float maxScale() const {
+        return std::sqrt(std::max({glm::dot(mat[0], mat[0]), glm::dot(mat[1], mat[1]), glm::dot(mat[2], mat[2])}));
+    }
+};
+
+// Constant rotation around an axis, like a pivot swinging a moon around its planet
+struct spin
+{
+    glm::vec3 axis{0.f, 1.f, 0.f};
+    // Radians per second
+    float speed{1.f};
+};
+
+// Point light at the entity's world position (see lightclusters.h)
+struct light
+{
+    glm::vec3 color{1.f, 1.f, 1.f};
+    // Distance where the light has faded out, 0 reaches everything without fading
+    float radius{0.f};
+};
+
 struct camera
 {
     glm::mat4 proj;
@@ -158,18 +192,31 @@ struct camera
 
 struct mesh
 {
-    /**
-     * Vertex Array Object(renderinfo),
-     * Vertex Buffer Object(vertex info),
-     * Index/Element Buffer Object(intex or triangle info)
-     */
-    unsigned int VAO, VBO, IBO;
+    // Shared Vertex Array Object of the geometry arena holding the mesh (see geometrybuffer.h)
+    unsigned int VAO{0};
+    // Handle of the mesh in GeometryBuffer
+    unsigned int geometry{0};
+    // Offsets into the arena's buffers, in vertices and indices
+    GLint baseVertex{0};
+    GLuint firstIndex{0};
     unsigned int vertexCount{0};
-    bool bIndices : 1;
-    unsigned int indexCount : 7;
+    bool bIndices{false};
+    // 32-bit indices (GL_UNSIGNED_INT)
+    unsigned int indexCount{0};
     GLenum drawMode{GL_TRIANGLES};
 
-    mesh() : bIndices{false}, vertexCount{0}, indexCount{0} {}
+    // Triangles submitted by one draw of this mesh
+    unsigned int triangleCount() const {
+        return (drawMode == GL_TRIANGLES) ? (bIndices ? indexCount : vertexCount) / 3 : 0;
+    }
+
+    // Draws the mesh, expects VAO to be bound
+    void draw() const {
+        if (bIndices)
+            glDrawElementsBaseVertex(drawMode, indexCount, GL_UNSIGNED_INT, (void *)(firstIndex * sizeof(GLuint)), baseVertex);
+        else
+            glDrawArrays(drawMode, baseVertex, vertexCount);
+    }
 };
 
 struct mat
@@ -192,9 +239,19 @@ struct phys
     bool bStatic{false};
 };
 
+// Level of detail currently used for an entity drawn from a LodSet
+struct lod
+{
+    unsigned int level{0};
+    // Culled and drawn on the GPU instead (see gpuculling.h)
+    bool bGpuCulled{false};
+};
+
 struct particle
 {
-    iqueue<glm::vec3> pos;
+    static constexpr unsigned int NONE = ~0u;
+    // Column of the particle in the trail ring (see particles.h), given on its first update
+    unsigned int index{NONE};
     glm::vec3 scale;
 };
 }
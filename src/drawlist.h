@@ -0,0 +1,100 @@
+#ifndef DRAWLIST_H
+#define DRAWLIST_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include "components.h"
+#include "threadpool.h"
+#include "trace.h"
+#include "glstate.h"
+
+/**
+ * Draws recorded as plain structs on worker threads and replayed on the GL thread.
+ * Every batch of the visible set records into its own buffer, so recording needs
+ * no locks. The buffers are merged in batch order and sorted by program and VAO,
+ * so replaying only issues the GL calls themselves.
+ * Recording functions may read and write existing components, but must not add
+ * or remove any while the workers run.
+ */
+class DrawList
+{
+public:
+    struct command
+    {
+        unsigned int shader;
+        glm::mat4 model;
+        glm::vec3 color;
+        component::mesh mesh;
+
+        std::uint64_t key() const { return (static_cast<std::uint64_t>(shader) << 32) | mesh.VAO; }
+    };
+
+    // Items per recording batch
+    static constexpr std::size_t BATCH_SIZE = 128;
+
+private:
+    // Kept between frames to reuse their memory
+    std::vector<std::vector<command>> mBatches;
+    std::vector<command> mCommands;
+
+public:
+    /**
+     * Calls recordItem(i, out) for every i in [0, count) on the thread pool.
+     * recordItem pushes the draws of item i to out.
+     */
+    template <typename F>
+    void record(std::size_t count, F&& recordItem) {
+        const auto batches = (count + BATCH_SIZE - 1) / BATCH_SIZE;
+        if (mBatches.size() < batches)
+            mBatches.resize(batches);
+
+        ThreadPool::get().parallelFor(count, BATCH_SIZE, [&](std::size_t begin, std::size_t end) {
+            TraceZone zone{"DrawList::record"};
+            auto& out = mBatches[begin / BATCH_SIZE];
+            out.clear();
+            for (auto i{begin}; i < end; ++i)
+                recordItem(i, out);
+        });
+
+        mCommands.clear();
+        for (std::size_t i{0}; i < batches; ++i)
+            mCommands.insert(mCommands.end(), mBatches[i].begin(), mBatches[i].end());
+        std::stable_sort(mCommands.begin(), mCommands.end(), [](const command& a, const command& b) { return a.key() < b.key(); });
+    }
+
+    /**
+     * Issues the recorded draws. useShader(program) is called when the program changes
+     * and sets the per program uniforms. Returns the number of triangles drawn.
+     */
+    template <typename F>
+    unsigned int replay(F&& useShader) const {
+        unsigned int shader{0}, VAO{0}, triangles{0};
+        GLint modelLocation{-1}, colorLocation{-1};
+        for (const auto& c : mCommands) {
+            if (c.shader != shader) {
+                shader = c.shader;
+                useShader(shader);
+                modelLocation = glGetUniformLocation(shader, "uModel");
+                colorLocation = glGetUniformLocation(shader, "color");
+            }
+            if (c.mesh.VAO != VAO) {
+                VAO = c.mesh.VAO;
+                GLState::get().bindVertexArray(VAO);
+            }
+
+            glUniformMatrix4fv(modelLocation, 1, GL_FALSE, glm::value_ptr(c.model));
+            glUniform3fv(colorLocation, 1, glm::value_ptr(c.color));
+            c.mesh.draw();
+            triangles += c.mesh.triangleCount();
+        }
+        return triangles;
+    }
+
+    std::size_t size() const { return mCommands.size(); }
+};
+
+#endif // DRAWLIST_H
@@ -0,0 +1,168 @@
+#ifndef DYNAMICRESOLUTION_H
+#define DYNAMICRESOLUTION_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <array>
+#include <algorithm>
+#include <cmath>
+
+/**
+ * Picks the internal render resolution and bloom blur divisor that hold a target GPU frame time.
+ * The GPU time between beginFrame() and endFrame() is measured with GL_TIMESTAMP queries,
+ * read a few frames later once available, so measuring never stalls. Over the target the
+ * blur is made coarser first and then the render scale lowered; well under it the render
+ * scale is raised first and then the blur made finer again. Changes wait until the frames
+ * rendered with the previous settings have been measured.
+ */
+class DynamicResolution
+{
+public:
+    // Bounds of the render scale (fraction of the window size per axis)
+    static constexpr float MIN_SCALE = 0.5f;
+    static constexpr float MAX_SCALE = 1.f;
+    static constexpr float SCALE_STEP = 0.05f;
+    // Bounds of the bloom blur divisor (fraction of the render size per axis)
+    static constexpr unsigned int MIN_BLUR_DIVISOR = 2;
+    static constexpr unsigned int MAX_BLUR_DIVISOR = 4;
+    // Frames in flight before a query is read back
+    static constexpr unsigned int LATENCY = 4;
+    // Only raise quality when the frame time is below this fraction of the target
+    static constexpr float HEADROOM = 0.8f;
+    // Weight of the newest frame in the smoothed GPU time
+    static constexpr float SMOOTHING = 0.2f;
+
+private:
+    struct slot
+    {
+        GLuint begin{0}, end{0};
+        bool bPending{false};
+        // Settings the frame was rendered with
+        unsigned long long generation{0};
+    };
+
+    std::array<slot, LATENCY> mSlots{};
+    unsigned int mSlot{0};
+    bool bMeasuring{false};
+
+    float mTargetMs;
+    float mGpuMs{0.f};
+    // Measured frames since the settings changed
+    unsigned int mSamples{0};
+    unsigned long long mGeneration{0};
+    float mScale{MAX_SCALE};
+    unsigned int mBlurDivisor{MIN_BLUR_DIVISOR};
+
+    // Reads the finished queries and feeds them to the controller
+    void resolve() {
+        for (auto& s : mSlots) {
+            if (!s.bPending)
+                continue;
+
+            GLint available{GL_FALSE};
+            glGetQueryObjectiv(s.end, GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+                continue;
+
+            GLuint64 begin, end;
+            glGetQueryObjectui64v(s.begin, GL_QUERY_RESULT, &begin);
+            glGetQueryObjectui64v(s.end, GL_QUERY_RESULT, &end);
+            s.bPending = false;
+            // Frames rendered before the last change don't tell anything about the current settings
+            if (s.generation != mGeneration)
+                continue;
+
+            const auto ms = (end - begin) * 1e-6f;
+            mGpuMs = mSamples == 0 ? ms : mGpuMs + SMOOTHING * (ms - mGpuMs);
+            ++mSamples;
+        }
+    }
+
+    void adjust() {
+        // Wait for a few frames of the current settings
+        if (mSamples < LATENCY)
+            return;
+
+        const auto scale = mScale;
+        const auto blurDivisor = mBlurDivisor;
+        if (mTargetMs < mGpuMs) {
+            if (mBlurDivisor < MAX_BLUR_DIVISOR)
+                mBlurDivisor *= 2;
+            else {
+                // Fragment cost goes with the pixel count, the square of the scale
+                const auto fit = std::floor(mScale * std::sqrt(mTargetMs / mGpuMs) / SCALE_STEP) * SCALE_STEP;
+                mScale = std::max(MIN_SCALE, std::min(mScale - SCALE_STEP, fit));
+            }
+        } else if (mGpuMs < mTargetMs * HEADROOM) {
+            if (mScale < MAX_SCALE)
+                mScale = std::min(MAX_SCALE, mScale + SCALE_STEP);
+            else if (MIN_BLUR_DIVISOR < mBlurDivisor)
+                mBlurDivisor /= 2;
+        }
+
+        if (scale != mScale || blurDivisor != mBlurDivisor) {
+            ++mGeneration;
+            mSamples = 0;
+        }
+    }
+
+public:
+    DynamicResolution(float targetMs)
+        : mTargetMs{targetMs}
+    {
+        for (auto& s : mSlots) {
+            glGenQueries(1, &s.begin);
+            glGenQueries(1, &s.end);
+        }
+    }
+
+    DynamicResolution(const DynamicResolution&) = delete;
+    DynamicResolution(DynamicResolution&&) = delete;
+    void operator=(const DynamicResolution&) = delete;
+    void operator=(DynamicResolution&&) = delete;
+
+    // Call before the first GL command of the frame, updates scale() and blurDivisor()
+    void beginFrame() {
+        resolve();
+        adjust();
+
+        // A slot still in flight means the GPU is far behind, that frame just isn't measured
+        auto& s = mSlots[mSlot];
+        bMeasuring = !s.bPending;
+        if (bMeasuring)
+            glQueryCounter(s.begin, GL_TIMESTAMP);
+    }
+
+    // Call after the last GL command of the frame
+    void endFrame() {
+        if (!bMeasuring)
+            return;
+
+        auto& s = mSlots[mSlot];
+        glQueryCounter(s.end, GL_TIMESTAMP);
+        s.bPending = true;
+        s.generation = mGeneration;
+        mSlot = (mSlot + 1) % LATENCY;
+        bMeasuring = false;
+    }
+
+    // Render size for a window of the given size, at least one pixel
+    glm::ivec2 renderSize(const glm::ivec2& windowSize) const {
+        return glm::max(glm::ivec2{glm::vec2{windowSize} * mScale + 0.5f}, glm::ivec2{1});
+    }
+
+    float scale() const { return mScale; }
+    unsigned int blurDivisor() const { return mBlurDivisor; }
+    // Smoothed GPU time of the frames rendered with the current settings
+    float gpuMs() const { return mGpuMs; }
+    float targetMs() const { return mTargetMs; }
+
+    ~DynamicResolution() {
+        for (auto& s : mSlots) {
+            glDeleteQueries(1, &s.begin);
+            glDeleteQueries(1, &s.end);
+        }
+    }
+};
+
+#endif // DYNAMICRESOLUTION_H
@@ -0,0 +1,245 @@
+#ifndef FRAMECAPTURE_H
+#define FRAMECAPTURE_H
+
+#include <glad/glad.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+#include "glstate.h"
+#include "gpumemory.h"
+
+/**
+ * Records every frame as an image sequence (<prefix>_00000.ppm, ...) without stalling the GPU.
+ * Frames are read into a ring of persistently mapped pixel pack buffers and only copied out
+ * LATENCY frames later, when their fence has signaled, so glReadPixels returns at once.
+ * Converting and writing the files happens on a writer thread.
+ * A video can be made from the sequence with e.g. ffmpeg -i <prefix>_%05d.ppm.
+ */
+class FrameCapture
+{
+public:
+    // Frames between reading a frame and copying it out of its buffer
+    static constexpr unsigned int LATENCY = 3;
+    // Frames waiting for the writer before capture() blocks
+    static constexpr std::size_t MAX_QUEUED = 8;
+
+private:
+    struct slot
+    {
+        unsigned int buffer{0};
+        const std::byte* mapped{nullptr};
+        GLsync fence{nullptr};
+        unsigned long long frame{0};
+    };
+
+    struct image
+    {
+        unsigned long long frame;
+        std::vector<std::byte> pixels;
+    };
+
+    std::string mPrefix;
+    GLsizei mWidth{0}, mHeight{0};
+    std::vector<slot> mSlots;
+    unsigned int mSlot{0};
+    unsigned long long mFrame{0};
+    // Frames where the GPU hadn't finished a read yet or the writer was behind
+    unsigned long long mStalls{0};
+
+    // Written by the writer thread
+    std::thread mWriter;
+    std::mutex mMutex;
+    std::condition_variable mWake, mDone;
+    std::deque<image> mQueue;
+    // Pixel memory of written frames, reused for the next ones
+    std::vector<std::vector<std::byte>> mFree;
+    std::size_t mWriting{0};
+    unsigned long long mWritten{0};
+    bool bStop{false};
+
+    void write() {
+        while (true) {
+            image frame;
+            {
+                std::unique_lock<std::mutex> lock{mMutex};
+                mWake.wait(lock, [this]() { return bStop || !mQueue.empty(); });
+                if (bStop && mQueue.empty())
+                    return;
+                frame = std::move(mQueue.front());
+                mQueue.pop_front();
+                ++mWriting;
+            }
+
+            const bool bWritten = writeImage(frame);
+
+            std::lock_guard<std::mutex> lock{mMutex};
+            mFree.push_back(std::move(frame.pixels));
+            --mWriting;
+            mWritten += bWritten;
+            mDone.notify_all();
+        }
+    }
+
+    // Writes a bottom up RGBA frame as a binary PPM image
+    bool writeImage(image& frame) const {
+        std::ostringstream file{};
+        file << mPrefix << "_" << std::setw(5) << std::setfill('0') << frame.frame << ".ppm";
+        std::ofstream ofs{file.str(), std::ios::binary};
+        if (!ofs) {
+            std::cout << "FrameCapture couldn't open " << file.str() << " for writing." << std::endl;
+            return false;
+        }
+
+        // Packs the rows to RGB in place, PPM rows go top to bottom
+        const auto width = static_cast<std::size_t>(mWidth);
+        const auto pixels = frame.pixels.data();
+        for (std::size_t i{0}; i < width * mHeight; ++i)
+            std::memmove(pixels + i * 3, pixels + i * 4, 3);
+
+        ofs << "P6\n" << mWidth << " " << mHeight << "\n255\n";
+        for (auto y{static_cast<std::size_t>(mHeight)}; 0 < y--;)
+            ofs.write(reinterpret_cast<const char*>(pixels + y * width * 3), width * 3);
+        return true;
+    }
+
+    // Waits for a slot's read and hands its pixels to the writer
+    void retire(slot& s) {
+        if (s.fence == nullptr)
+            return;
+
+        auto status = glClientWaitSync(s.fence, 0, 0);
+        if (status == GL_TIMEOUT_EXPIRED) {
+            ++mStalls;
+            do {
+                status = glClientWaitSync(s.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+            } while (status == GL_TIMEOUT_EXPIRED);
+        }
+        glDeleteSync(s.fence);
+        s.fence = nullptr;
+
+        const auto size = static_cast<std::size_t>(mWidth) * mHeight * 4;
+        std::unique_lock<std::mutex> lock{mMutex};
+        if (MAX_QUEUED <= mQueue.size()) {
+            ++mStalls;
+            mDone.wait(lock, [this]() { return mQueue.size() < MAX_QUEUED; });
+        }
+        std::vector<std::byte> pixels{};
+        if (!mFree.empty()) {
+            pixels = std::move(mFree.back());
+            mFree.pop_back();
+        }
+        lock.unlock();
+
+        // Copied outside the lock so the writer keeps going
+        pixels.resize(size);
+        std::memcpy(pixels.data(), s.mapped, size);
+
+        lock.lock();
+        mQueue.push_back({s.frame, std::move(pixels)});
+        lock.unlock();
+        mWake.notify_one();
+    }
+
+    void createBuffers(GLsizei width, GLsizei height) {
+        finish();
+        destroyBuffers();
+        mWidth = width;
+        mHeight = height;
+
+        constexpr GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        const auto size = static_cast<GLsizeiptr>(width) * height * 4;
+        mSlots.resize(LATENCY);
+        for (auto& s : mSlots) {
+            glCreateBuffers(1, &s.buffer);
+            GpuMemory::get().bufferStorage("FrameCapture", s.buffer, size, nullptr, flags);
+            s.mapped = static_cast<const std::byte*>(glMapNamedBufferRange(s.buffer, 0, size, flags));
+            if (s.mapped == nullptr)
+                std::cout << "FrameCapture: failed to map pixel buffer persistently." << std::endl;
+        }
+        mSlot = 0;
+    }
+
+    void destroyBuffers() {
+        for (auto& s : mSlots) {
+            if (s.fence != nullptr)
+                glDeleteSync(s.fence);
+            glUnmapNamedBuffer(s.buffer);
+            GpuMemory::get().deleteBuffers(1, &s.buffer);
+        }
+        mSlots.clear();
+    }
+
+public:
+    // Numbering starts at firstFrame, so a recording can continue the sequence of an earlier one
+    FrameCapture(const std::string& prefix, unsigned long long firstFrame = 0)
+        : mPrefix{prefix}, mFrame{firstFrame}
+    {
+        mWriter = std::thread{[this]() { write(); }};
+    }
+
+    FrameCapture(const FrameCapture&) = delete;
+    FrameCapture(FrameCapture&&) = delete;
+    void operator=(const FrameCapture&) = delete;
+    void operator=(FrameCapture&&) = delete;
+
+    /**
+     * Starts reading the color buffer of framebuffer (0 is the window) and
+     * hands the frame read LATENCY captures ago to the writer.
+     */
+    void capture(unsigned int framebuffer, GLsizei width, GLsizei height) {
+        if (width != mWidth || height != mHeight || mSlots.empty())
+            createBuffers(width, height);
+
+        auto& s = mSlots[mSlot];
+        retire(s);
+        if (s.mapped == nullptr)
+            return;
+
+        GLState::get().bindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, s.buffer);
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+        glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        s.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        s.frame = mFrame++;
+        mSlot = (mSlot + 1) % mSlots.size();
+    }
+
+    // Hands every pending frame to the writer and waits until they're written
+    void finish() {
+        for (std::size_t i{0}; i < mSlots.size(); ++i)
+            retire(mSlots[(mSlot + i) % mSlots.size()]);
+
+        std::unique_lock<std::mutex> lock{mMutex};
+        mDone.wait(lock, [this]() { return mQueue.empty() && mWriting == 0; });
+    }
+
+    // Number of the next frame, the frames captured so far if numbering started at 0
+    unsigned long long frames() const { return mFrame; }
+    unsigned long long stalls() const { return mStalls; }
+    const std::string& prefix() const { return mPrefix; }
+
+    ~FrameCapture() {
+        finish();
+        {
+            std::lock_guard<std::mutex> lock{mMutex};
+            bStop = true;
+        }
+        mWake.notify_all();
+        mWriter.join();
+        destroyBuffers();
+        std::cout << "Captured " << mWritten << " frames to " << mPrefix << "_*.ppm" << std::endl;
+    }
+};
+
+#endif // FRAMECAPTURE_H
@@ -0,0 +1,73 @@
+#ifndef FRAMEDAMAGE_H
+#define FRAMEDAMAGE_H
+
+#include <entt/entt.hpp>
+#include <glm/glm.hpp>
+#include <vector>
+#include "components.h"
+
+/**
+ * Decides if a frame has to be rendered or if the last presented one is still correct.
+ * Compares the camera, screen size and materials against the last rendered frame and
+ * counts any rebuilt world matrix as a change. Things it can't see, like toggled render
+ * settings or a window that needs repainting, are reported with damage().
+ */
+class FrameDamage
+{
+private:
+    struct materialState
+    {
+        entt::entity entity;
+        component::mat material;
+    };
+
+    glm::mat4 mView{0.f}, mProj{0.f};
+    glm::ivec2 mScreenSize{0};
+    std::vector<materialState> mMaterials;
+    bool bDamaged{true};
+    unsigned int mSkipped{0};
+
+    // Updates the material snapshot, returns true if anything differed
+    bool updateMaterials(entt::registry& EM) {
+        auto view = EM.view<component::mat>();
+        bool bChanged = view.size() != mMaterials.size();
+        mMaterials.resize(view.size());
+        std::size_t i{0};
+        for (auto entity : view) {
+            const auto& m = view.get<component::mat>(entity);
+            auto& last = mMaterials[i++];
+            if (last.entity != entity || last.material.shader != m.shader || last.material.color != m.color || last.material.bDrawn != m.bDrawn) {
+                last = {entity, m};
+                bChanged = true;
+            }
+        }
+        return bChanged;
+    }
+
+public:
+    // Forces the next frame to be rendered
+    void damage() { bDamaged = true; }
+
+    /**
+     * Returns true if this frame has to be rendered.
+     * bAnimating covers changes found elsewhere, like the simulation running or rebuilt transforms.
+     */
+    bool update(entt::registry& EM, const component::camera& camera, const glm::ivec2& screenSize, bool bAnimating) {
+        // All checks run so every snapshot is current
+        bool bChanged = updateMaterials(EM);
+        bChanged |= camera.view != mView || camera.proj != mProj || screenSize != mScreenSize;
+        bChanged |= bAnimating || bDamaged;
+        mView = camera.view;
+        mProj = camera.proj;
+        mScreenSize = screenSize;
+        bDamaged = false;
+
+        mSkipped = bChanged ? 0 : mSkipped + 1;
+        return bChanged;
+    }
+
+    // Frames skipped in a row since the last rendered one
+    unsigned int skipped() const { return mSkipped; }
+};
+
+#endif // FRAMEDAMAGE_H
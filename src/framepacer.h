@@ -0,0 +1,116 @@
+#ifndef FRAMEPACER_H
+#define FRAMEPACER_H
+
+#include <glad/glad.h>
+#include <array>
+#include <deque>
+#include <algorithm>
+#include <vector>
+#include <cstdint>
+
+/**
+ * Limits the frames queued ahead on the GPU and measures input to present latency.
+ * Every presented frame gets a GL_TIMESTAMP query and a fence after the swap. wait() blocks
+ * until few enough of them are left on the GPU, so input sampled right after it reaches the
+ * screen with the least delay. The latency of a frame is the GPU time from inputSampled() until
+ * its query was reached, which includes the present but not the display's scanout. Both ends
+ * are taken by the GPU, so when the CPU gets around to retiring the frame doesn't matter and
+ * the numbers with and without blocking can be compared.
+ */
+class FramePacer
+{
+public:
+    // Frames of latency kept for latencyMs() and maxLatencyMs()
+    static constexpr std::size_t WINDOW = 64;
+
+private:
+    struct frame
+    {
+        GLsync fence;
+        GLuint presented;
+        GLint64 inputNs;
+    };
+
+    std::deque<frame> mFrames;
+    std::vector<GLuint> mFreeQueries;
+    GLint64 mInputNs{0};
+    std::array<float, WINDOW> mLatencies{};
+    std::size_t mLatencyCount{0};
+
+    // The fence comes after the query, so its result is ready and this doesn't stall
+    void retire(const frame& f) {
+        GLint64 presentedNs;
+        glGetQueryObjecti64v(f.presented, GL_QUERY_RESULT, &presentedNs);
+        mLatencies[mLatencyCount++ % WINDOW] = (presentedNs - f.inputNs) * 0.000001f;
+        glDeleteSync(f.fence);
+        mFreeQueries.push_back(f.presented);
+    }
+
+public:
+    FramePacer() = default;
+
+    FramePacer(const FramePacer&) = delete;
+    FramePacer(FramePacer&&) = delete;
+    void operator=(const FramePacer&) = delete;
+    void operator=(FramePacer&&) = delete;
+
+    /**
+     * Retires the frames the GPU has finished. With maxQueued above 0 it also waits
+     * until fewer than maxQueued frames are left in flight.
+     */
+    void wait(unsigned int maxQueued = 0) {
+        while (!mFrames.empty()) {
+            const bool bBlock = 0 < maxQueued && maxQueued <= mFrames.size();
+            const auto status = glClientWaitSync(mFrames.front().fence, GL_SYNC_FLUSH_COMMANDS_BIT, bBlock ? 1000000 : 0);
+            if (status == GL_TIMEOUT_EXPIRED) {
+                if (bBlock)
+                    continue;
+                break;
+            }
+            retire(mFrames.front());
+            mFrames.pop_front();
+        }
+    }
+
+    // Call when the input the frame is rendered with has been read
+    void inputSampled() { glGetInteger64v(GL_TIMESTAMP, &mInputNs); }
+
+    // Call after the frame has been swapped
+    void endFrame() {
+        GLuint presented;
+        if (mFreeQueries.empty()) {
+            glGenQueries(1, &presented);
+        }
+        else {
+            presented = mFreeQueries.back();
+            mFreeQueries.pop_back();
+        }
+        glQueryCounter(presented, GL_TIMESTAMP);
+        mFrames.push_back({glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0), presented, mInputNs});
+    }
+
+    // Average and maximum latency of the last WINDOW frames
+    float latencyMs() const {
+        const auto n = std::min(mLatencyCount, WINDOW);
+        float sum{0.f};
+        for (std::size_t i{0}; i < n; ++i)
+            sum += mLatencies[i];
+        return n == 0 ? 0.f : sum / n;
+    }
+
+    float maxLatencyMs() const {
+        if (mLatencyCount == 0)
+            return 0.f;
+        return *std::max_element(mLatencies.begin(), mLatencies.begin() + std::min(mLatencyCount, WINDOW));
+    }
+
+    ~FramePacer() {
+        for (const auto& f : mFrames) {
+            glDeleteSync(f.fence);
+            mFreeQueries.push_back(f.presented);
+        }
+        glDeleteQueries(static_cast<GLsizei>(mFreeQueries.size()), mFreeQueries.data());
+    }
+};
+
+#endif // FRAMEPACER_H
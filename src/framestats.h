@@ -0,0 +1,281 @@
+#ifndef FRAMESTATS_H
+#define FRAMESTATS_H
+
+#include <glm/glm.hpp>
+#include <array>
+#include <deque>
+#include <vector>
+#include <atomic>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <cstdint>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include "trace.h"
+
+/**
+ * Rolling frame time statistics.
+ * The CPU (wall clock) and GPU times of the last WINDOW frames are kept in a ring.
+ * Percentiles come from a histogram and the maximum from a monotonic queue, both
+ * updated as frames enter and leave the ring, so nothing is sorted per frame.
+ *
+ * The main loop is the only writer. Readers don't lock: every slot is tagged with
+ * its frame number, and a slot whose tag changed while it was read is skipped.
+ */
+class FrameStats
+{
+public:
+    static constexpr std::uint64_t WINDOW = 512;
+    static constexpr float BUCKET_MS = 0.1f;
+    // The last bucket collects everything above BUCKETS * BUCKET_MS (software rasterizers easily take 100+ ms)
+    static constexpr std::size_t BUCKETS = 5000;
+    // Frames before hitches are detected
+    static constexpr unsigned int WARMUP = 60;
+    // Frames to wait for GPU times before giving up on them
+    static constexpr std::uint64_t GPU_LATENCY = 16;
+
+    struct sample
+    {
+        std::uint64_t frame;
+        float cpuMs;
+        // Negative until the GPU time is known
+        float gpuMs;
+    };
+
+    // Windowed histogram and maximum of one kind of frame time
+    class distribution
+    {
+    private:
+        std::array<unsigned int, BUCKETS> mBuckets{};
+        unsigned int mCount{0};
+        std::deque<std::pair<std::uint64_t, float>> mMaxima;
+
+        static std::size_t bucket(float ms) {
+            return std::min(static_cast<std::size_t>(std::max(ms, 0.f) / BUCKET_MS), BUCKETS - 1);
+        }
+
+    public:
+        // Frames must be added in increasing order
+        void add(std::uint64_t frame, float ms) {
+            ++mBuckets[bucket(ms)];
+            ++mCount;
+            while (!mMaxima.empty() && mMaxima.back().second <= ms)
+                mMaxima.pop_back();
+            mMaxima.emplace_back(frame, ms);
+        }
+
+        void remove(std::uint64_t frame, float ms) {
+            --mBuckets[bucket(ms)];
+            --mCount;
+            while (!mMaxima.empty() && mMaxima.front().first <= frame)
+                mMaxima.pop_front();
+        }
+
+        // Upper edge of the bucket holding the p-th (0 - 1) quantile, at most the maximum
+        float percentile(float p) const {
+            if (mCount == 0)
+                return 0.f;
+
+            const auto target = std::max(1u, static_cast<unsigned int>(std::ceil(p * mCount)));
+            unsigned int sum{0};
+            for (std::size_t i{0}; i < BUCKETS; ++i) {
+                sum += mBuckets[i];
+                if (target <= sum)
+                    return std::min((i + 1) * BUCKET_MS, max());
+            }
+            return max();
+        }
+
+        float max() const { return mMaxima.empty() ? 0.f : mMaxima.front().second; }
+        unsigned int count() const { return mCount; }
+    };
+
+    // Percentiles of a distribution
+    struct summary
+    {
+        float p50, p95, p99, max;
+    };
+
+private:
+    struct slot
+    {
+        // 0 while empty or being written
+        std::atomic<std::uint64_t> frame{0};
+        std::atomic<float> cpuMs{0.f};
+        std::atomic<float> gpuMs{-1.f};
+    };
+
+    std::array<slot, WINDOW> mRing;
+    std::atomic<std::uint64_t> mHead{0};
+    distribution mCpu, mGpu;
+    // Next frame to collect GPU times for
+    std::uint64_t mGpuFrame{1};
+    // Hitches waiting for their GPU times before being logged
+    std::deque<std::uint64_t> mHitches;
+    float mHitchFactor, mHitchMinMs;
+
+    slot& at(std::uint64_t frame) { return mRing[frame % WINDOW]; }
+
+    // Time the GPU was busy in a frame, overlapping zones only counted once
+    static float gpuBusyMs(std::vector<Tracer::event> events) {
+        events.erase(std::remove_if(events.begin(), events.end(), [](const Tracer::event& e) { return e.thread != 0; }), events.end());
+        std::sort(events.begin(), events.end(), [](const Tracer::event& a, const Tracer::event& b) { return a.start < b.start; });
+
+        std::int64_t busy{0}, end{std::numeric_limits<std::int64_t>::min()};
+        for (const auto& e : events) {
+            const auto start = std::max(e.start, end);
+            end = std::max(end, e.start + e.duration);
+            busy += std::max<std::int64_t>(end - start, 0);
+        }
+        return busy * 0.001f;
+    }
+
+    void logHitch(std::uint64_t frame, Tracer& tracer) {
+        auto& s = at(frame);
+        if (s.frame.load(std::memory_order_acquire) != frame)
+            return;
+
+        const auto flags = std::cout.flags();
+        const auto precision = std::cout.precision();
+        std::cout << std::fixed << std::setprecision(2) << "Hitch in frame " << frame << ": " << s.cpuMs.load() << " ms (p50 " << mCpu.percentile(0.5f) << " ms)";
+        const auto gpuMs = s.gpuMs.load();
+        if (0.f <= gpuMs)
+            std::cout << ", gpu " << gpuMs << " ms";
+
+        const auto events = tracer.events(frame);
+        for (unsigned int thread : {1u, 0u}) {
+            std::cout << (thread == 0 ? "\n    gpu:" : "\n    cpu:");
+            for (const auto& e : events)
+                if (e.thread == thread && std::string{e.name} != "frame")
+                    std::cout << " " << e.name << " " << e.duration * 0.001f;
+        }
+        std::cout << std::endl;
+        std::cout.flags(flags);
+        std::cout.precision(precision);
+    }
+
+public:
+    /**
+     * A frame is a hitch when it takes hitchFactor times the median frame time
+     * and at least hitchMinMs more than the median.
+     */
+    FrameStats(float hitchFactor = 2.f, float hitchMinMs = 4.f)
+        : mHitchFactor{hitchFactor}, mHitchMinMs{hitchMinMs}
+    {}
+
+    FrameStats(const FrameStats&) = delete;
+    FrameStats(FrameStats&&) = delete;
+    void operator=(const FrameStats&) = delete;
+    void operator=(FrameStats&&) = delete;
+
+    // Adds the wall clock time of a frame (frame numbers as in Tracer). Returns true if it was a hitch.
+    bool push(std::uint64_t frame, float cpuMs) {
+        if (frame == 0)
+            return false;
+
+        auto& s = at(frame);
+        if (const auto old = s.frame.load(std::memory_order_relaxed); old != 0) {
+            mCpu.remove(old, s.cpuMs.load(std::memory_order_relaxed));
+            if (const auto gpuMs = s.gpuMs.load(std::memory_order_relaxed); 0.f <= gpuMs)
+                mGpu.remove(old, gpuMs);
+        }
+
+        const auto median = mCpu.percentile(0.5f);
+        const bool bHitch = WARMUP <= mCpu.count() && mHitchFactor * median < cpuMs && median + mHitchMinMs < cpuMs;
+
+        s.frame.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        s.cpuMs.store(cpuMs, std::memory_order_relaxed);
+        s.gpuMs.store(-1.f, std::memory_order_relaxed);
+        s.frame.store(frame, std::memory_order_release);
+        mHead.store(frame, std::memory_order_release);
+        mCpu.add(frame, cpuMs);
+
+        if (bHitch)
+            mHitches.push_back(frame);
+        return bHitch;
+    }
+
+    // Picks up GPU times from the resolved trace zones and logs hitches once their GPU times are in.
+    void collect(Tracer& tracer) {
+        const auto head = mHead.load(std::memory_order_relaxed);
+        const auto resolved = std::min(tracer.gpuResolvedFrame(), head);
+        mGpuFrame = std::max(mGpuFrame, head < WINDOW ? 1 : head - WINDOW + 1);
+        for (; mGpuFrame <= resolved; ++mGpuFrame) {
+            auto& s = at(mGpuFrame);
+            if (s.frame.load(std::memory_order_relaxed) != mGpuFrame)
+                continue;
+
+            const auto gpuMs = gpuBusyMs(tracer.events(mGpuFrame));
+            s.gpuMs.store(gpuMs, std::memory_order_release);
+            mGpu.add(mGpuFrame, gpuMs);
+        }
+
+        while (!mHitches.empty() && (mHitches.front() <= resolved || mHitches.front() + GPU_LATENCY < head)) {
+            logHitch(mHitches.front(), tracer);
+            mHitches.pop_front();
+        }
+    }
+
+    summary cpu() const { return {mCpu.percentile(0.5f), mCpu.percentile(0.95f), mCpu.percentile(0.99f), mCpu.max()}; }
+    summary gpu() const { return {mGpu.percentile(0.5f), mGpu.percentile(0.95f), mGpu.percentile(0.99f), mGpu.max()}; }
+
+    // Copies the kept frames, oldest first. Safe to call from any thread.
+    std::vector<sample> snapshot() const {
+        const auto head = mHead.load(std::memory_order_acquire);
+        std::vector<sample> samples;
+        samples.reserve(WINDOW);
+        for (auto frame{head < WINDOW ? 1 : head - WINDOW + 1}; frame != 0 && frame <= head; ++frame) {
+            const auto& s = mRing[frame % WINDOW];
+            if (s.frame.load(std::memory_order_acquire) != frame)
+                continue;
+            const sample result{frame, s.cpuMs.load(std::memory_order_relaxed), s.gpuMs.load(std::memory_order_relaxed)};
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (s.frame.load(std::memory_order_relaxed) == frame)
+                samples.push_back(result);
+        }
+        return samples;
+    }
+
+    // CPU and GPU time per frame, oldest first and padded to WINDOW entries (for the frame graph)
+    std::vector<glm::vec2> graph() const {
+        std::vector<glm::vec2> values(WINDOW, glm::vec2{0.f});
+        const auto samples = snapshot();
+        const auto offset = WINDOW - samples.size();
+        for (std::size_t i{0}; i < samples.size(); ++i)
+            values[offset + i] = {samples[i].cpuMs, std::max(samples[i].gpuMs, 0.f)};
+        return values;
+    }
+
+    bool writeCsv(const std::string& file) const {
+        std::ofstream ofs{file};
+        if (!ofs) {
+            std::cout << "FrameStats couldn't open " << file << " for writing." << std::endl;
+            return false;
+        }
+
+        const auto samples = snapshot();
+        ofs << "frame,cpu_ms,gpu_ms\n";
+        for (const auto& s : samples) {
+            ofs << s.frame << "," << s.cpuMs << ",";
+            if (0.f <= s.gpuMs)
+                ofs << s.gpuMs;
+            ofs << "\n";
+        }
+
+        std::cout << "Wrote " << samples.size() << " frame times to " << file << std::endl;
+        return true;
+    }
+};
+
+inline std::ostream& operator<<(std::ostream& os, const FrameStats::summary& s) {
+    const auto precision = os.precision(3);
+    os << s.p50 << "/" << s.p95 << "/" << s.p99 << "/" << s.max;
+    os.precision(precision);
+    return os;
+}
+
+#endif // FRAMESTATS_H
@@ -0,0 +1,35 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <glm/glm.hpp>
+#include <array>
+
+/**
+ * View frustum as 6 normalized planes (left, right, bottom, top, near, far),
+ * extracted from a view projection matrix (Gribb & Hartmann).
+ * A point p is inside a plane when dot(plane.xyz, p) + plane.w >= 0.
+ */
+struct frustum
+{
+    std::array<glm::vec4, 6> planes{};
+
+    static frustum fromMatrix(const glm::mat4& viewProj) {
+        // glm is column major, so rows are picked out across the columns
+        const auto row = [&](int i) { return glm::vec4{viewProj[0][i], viewProj[1][i], viewProj[2][i], viewProj[3][i]}; };
+        frustum f{};
+        f.planes = {row(3) + row(0), row(3) - row(0), row(3) + row(1), row(3) - row(1), row(3) + row(2), row(3) - row(2)};
+        for (auto& p : f.planes)
+            p /= glm::length(glm::vec3{p});
+        return f;
+    }
+
+    // Conservative: true if the sphere is at least partly inside
+    bool intersects(const glm::vec3& center, float radius) const {
+        for (const auto& p : planes)
+            if (glm::dot(glm::vec3{p}, center) + p.w < -radius)
+                return false;
+        return true;
+    }
+};
+
+#endif // FRUSTUM_H
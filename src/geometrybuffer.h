@@ -0,0 +1,402 @@
+#ifndef GEOMETRYBUFFER_H
+#define GEOMETRYBUFFER_H
+
+#include <glad/glad.h>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <memory>
+#include <limits>
+#include <algorithm>
+#include <iterator>
+#include <ostream>
+#include "components.h"
+#include "vertexformat.h"
+#include "gpumemory.h"
+
+// First fit allocator over a range of elements. Neighbouring free blocks are merged on release.
+class FreeList
+{
+private:
+    // Offset -> size of every free block
+    std::map<GLuint, GLuint> mFree;
+    GLuint mCapacity{0};
+
+public:
+    static constexpr GLuint none = std::numeric_limits<GLuint>::max();
+
+    explicit FreeList(GLuint capacity = 0) { grow(capacity); }
+
+    GLuint allocate(GLuint size) {
+        for (auto it{mFree.begin()}; it != mFree.end(); ++it) {
+            if (it->second < size)
+                continue;
+
+            const auto offset = it->first;
+            const auto remaining = it->second - size;
+            mFree.erase(it);
+            if (0 < remaining)
+                mFree.emplace(offset + size, remaining);
+            return offset;
+        }
+        return none;
+    }
+
+    void release(GLuint offset, GLuint size) {
+        if (size == 0)
+            return;
+
+        auto block = mFree.emplace(offset, size).first;
+        if (auto after = std::next(block); after != mFree.end() && block->first + block->second == after->first) {
+            block->second += after->second;
+            mFree.erase(after);
+        }
+        if (block != mFree.begin()) {
+            if (auto before = std::prev(block); before->first + before->second == block->first) {
+                before->second += block->second;
+                mFree.erase(block);
+            }
+        }
+    }
+
+    // Adds [capacity(), capacity) as free space
+    void grow(GLuint capacity) {
+        if (capacity <= mCapacity)
+            return;
+
+        const auto old = mCapacity;
+        mCapacity = capacity;
+        release(old, capacity - old);
+    }
+
+    // Marks [0, used) as allocated and the rest as free, like after compacting
+    void reset(GLuint used) {
+        mFree.clear();
+        if (used < mCapacity)
+            mFree.emplace(used, mCapacity - used);
+    }
+
+    GLuint capacity() const { return mCapacity; }
+    GLuint freeSpace() const {
+        GLuint sum{0};
+        for (const auto& [offset, size] : mFree)
+            sum += size;
+        return sum;
+    }
+    std::size_t freeBlocks() const { return mFree.size(); }
+    // Free space that isn't one block at the end
+    bool fragmented() const {
+        return 1 < mFree.size() || (mFree.size() == 1 && mFree.begin()->first + mFree.begin()->second != mCapacity);
+    }
+};
+
+/**
+ * One vertex and one index buffer holding every mesh with the same vertex layout,
+ * with a single VAO set up for both. Meshes are placed with a free list per buffer
+ * and drawn with base vertex / first index offsets, so indices stay mesh relative.
+ * Buffers grow (by copying) when full.
+ */
+class GeometryArena
+{
+public:
+    struct range
+    {
+        GLint baseVertex{0};
+        GLuint vertexCount{0};
+        GLuint firstIndex{0};
+        GLuint indexCount{0};
+    };
+
+private:
+    vertexformat::layout mLayout;
+    unsigned int mVAO{0}, mVBO{0}, mIBO{0};
+    // Bumped whenever mVBO or mIBO is replaced
+    unsigned int mGeneration{0};
+    FreeList mVertices, mIndices;
+    std::unordered_map<unsigned int, range> mRanges;
+
+    // New buffer of newBytes holding the first copyBytes of buffer, which is deleted
+    static unsigned int reallocate(unsigned int buffer, GLsizeiptr copyBytes, GLsizeiptr newBytes) {
+        unsigned int b;
+        glCreateBuffers(1, &b);
+        GpuMemory::get().bufferStorage("Geometry", b, newBytes, nullptr, GL_DYNAMIC_STORAGE_BIT);
+        if (buffer != 0) {
+            if (0 < copyBytes)
+                glCopyNamedBufferSubData(buffer, b, 0, 0, copyBytes);
+            GpuMemory::get().deleteBuffers(1, &buffer);
+        }
+        return b;
+    }
+
+    void growVertices(GLuint capacity) {
+        mVBO = reallocate(mVBO, static_cast<GLsizeiptr>(mVertices.capacity()) * mLayout.stride, static_cast<GLsizeiptr>(capacity) * mLayout.stride);
+        mVertices.grow(capacity);
+        mLayout.attach(mVAO, mVBO);
+        ++mGeneration;
+    }
+
+    void growIndices(GLuint capacity) {
+        mIBO = reallocate(mIBO, mIndices.capacity() * sizeof(GLuint), capacity * sizeof(GLuint));
+        mIndices.grow(capacity);
+        glVertexArrayElementBuffer(mVAO, mIBO);
+        ++mGeneration;
+    }
+
+    GLuint allocateVertices(GLuint count) {
+        auto offset = mVertices.allocate(count);
+        if (offset == FreeList::none) {
+            growVertices(std::max(mVertices.capacity() * 2, mVertices.capacity() + count));
+            offset = mVertices.allocate(count);
+        }
+        return offset;
+    }
+
+    GLuint allocateIndices(GLuint count) {
+        auto offset = mIndices.allocate(count);
+        if (offset == FreeList::none) {
+            growIndices(std::max(mIndices.capacity() * 2, mIndices.capacity() + count));
+            offset = mIndices.allocate(count);
+        }
+        return offset;
+    }
+
+public:
+    GeometryArena(const vertexformat::layout& layout, GLuint vertexCapacity, GLuint indexCapacity)
+        : mLayout{layout}
+    {
+        glCreateVertexArrays(1, &mVAO);
+        growVertices(std::max(vertexCapacity, 1u));
+        growIndices(std::max(indexCapacity, 1u));
+    }
+
+    GeometryArena(const GeometryArena&) = delete;
+    GeometryArena(GeometryArena&&) = delete;
+    void operator=(const GeometryArena&) = delete;
+    void operator=(GeometryArena&&) = delete;
+
+    range add(unsigned int handle, const std::vector<vertex>& vertices, const std::vector<unsigned int>& indices) {
+        range r{};
+        r.vertexCount = static_cast<GLuint>(vertices.size());
+        r.baseVertex = static_cast<GLint>(allocateVertices(r.vertexCount));
+        const auto data = mLayout.encode(vertices);
+        glNamedBufferSubData(mVBO, static_cast<GLintptr>(r.baseVertex) * mLayout.stride, data.size(), data.data());
+
+        if (!indices.empty()) {
+            r.indexCount = static_cast<GLuint>(indices.size());
+            r.firstIndex = allocateIndices(r.indexCount);
+            glNamedBufferSubData(mIBO, r.firstIndex * sizeof(GLuint), indices.size() * sizeof(GLuint), indices.data());
+        }
+
+        mRanges[handle] = r;
+        return r;
+    }
+
+    void remove(unsigned int handle) {
+        auto it = mRanges.find(handle);
+        if (it == mRanges.end())
+            return;
+
+        mVertices.release(static_cast<GLuint>(it->second.baseVertex), it->second.vertexCount);
+        mIndices.release(it->second.firstIndex, it->second.indexCount);
+        mRanges.erase(it);
+    }
+
+    const range* find(unsigned int handle) const {
+        auto it = mRanges.find(handle);
+        return it != mRanges.end() ? &it->second : nullptr;
+    }
+
+    /**
+     * Moves every mesh to the front of new buffers (keeping their order),
+     * leaving all free space as one block at the end.
+     * Returns the number of bytes copied.
+     */
+    GLsizeiptr defragment() {
+        if (!mVertices.fragmented() && !mIndices.fragmented())
+            return 0;
+
+        std::vector<range*> ranges{};
+        for (auto& [handle, r] : mRanges)
+            ranges.push_back(&r);
+
+        unsigned int vbo, ibo;
+        glCreateBuffers(1, &vbo);
+        GpuMemory::get().bufferStorage("Geometry", vbo, static_cast<GLsizeiptr>(mVertices.capacity()) * mLayout.stride, nullptr, GL_DYNAMIC_STORAGE_BIT);
+        glCreateBuffers(1, &ibo);
+        GpuMemory::get().bufferStorage("Geometry", ibo, mIndices.capacity() * sizeof(GLuint), nullptr, GL_DYNAMIC_STORAGE_BIT);
+
+        GLsizeiptr copied{0};
+        GLuint vertexEnd{0}, indexEnd{0};
+        std::sort(ranges.begin(), ranges.end(), [](const range* a, const range* b) { return a->baseVertex < b->baseVertex; });
+        for (auto r : ranges) {
+            const GLsizeiptr bytes = static_cast<GLsizeiptr>(r->vertexCount) * mLayout.stride;
+            if (0 < bytes)
+                glCopyNamedBufferSubData(mVBO, vbo, static_cast<GLintptr>(r->baseVertex) * mLayout.stride, static_cast<GLintptr>(vertexEnd) * mLayout.stride, bytes);
+            r->baseVertex = static_cast<GLint>(vertexEnd);
+            vertexEnd += r->vertexCount;
+            copied += bytes;
+        }
+        std::sort(ranges.begin(), ranges.end(), [](const range* a, const range* b) { return a->firstIndex < b->firstIndex; });
+        for (auto r : ranges) {
+            const GLsizeiptr bytes = r->indexCount * sizeof(GLuint);
+            if (0 < bytes)
+                glCopyNamedBufferSubData(mIBO, ibo, r->firstIndex * sizeof(GLuint), indexEnd * sizeof(GLuint), bytes);
+            r->firstIndex = indexEnd;
+            indexEnd += r->indexCount;
+            copied += bytes;
+        }
+
+        GpuMemory::get().deleteBuffers(1, &mVBO);
+        GpuMemory::get().deleteBuffers(1, &mIBO);
+        mVBO = vbo;
+        mIBO = ibo;
+        mLayout.attach(mVAO, mVBO);
+        glVertexArrayElementBuffer(mVAO, mIBO);
+        ++mGeneration;
+        mVertices.reset(vertexEnd);
+        mIndices.reset(indexEnd);
+        return copied;
+    }
+
+    const vertexformat::layout& layout() const { return mLayout; }
+    unsigned int VAO() const { return mVAO; }
+    // Replaced when the arena grows or is defragmented, which bumps generation()
+    unsigned int vertexBuffer() const { return mVBO; }
+    unsigned int indexBuffer() const { return mIBO; }
+    unsigned int generation() const { return mGeneration; }
+    std::size_t meshCount() const { return mRanges.size(); }
+    const FreeList& vertexSpace() const { return mVertices; }
+    const FreeList& indexSpace() const { return mIndices; }
+
+    ~GeometryArena() {
+        GpuMemory::get().deleteBuffers(1, &mIBO);
+        GpuMemory::get().deleteBuffers(1, &mVBO);
+        glDeleteVertexArrays(1, &mVAO);
+    }
+};
+
+/**
+ * Storage for all mesh geometry, with one GeometryArena per vertex layout.
+ * component::mesh holds the arena's VAO and the offsets of the mesh inside it,
+ * so meshes sharing a layout are drawn without rebinding anything.
+ */
+class GeometryBuffer
+{
+public:
+    // Initial arena size, in vertices and indices
+    static constexpr GLuint ARENA_VERTICES = 1 << 16;
+    static constexpr GLuint ARENA_INDICES = 1 << 18;
+
+    struct stats
+    {
+        std::size_t arenas{0}, meshes{0};
+        GLsizeiptr usedBytes{0}, capacityBytes{0};
+        std::size_t freeBlocks{0};
+    };
+
+private:
+    std::vector<std::unique_ptr<GeometryArena>> mArenas;
+    std::unordered_map<unsigned int, GeometryArena*> mHandles;
+    unsigned int mNextHandle{1};
+
+    GeometryBuffer() = default;
+    GeometryBuffer(const GeometryBuffer&) = delete;
+    GeometryBuffer(GeometryBuffer&&) = delete;
+
+    GeometryArena& arena(const vertexformat::layout& layout) {
+        for (auto& a : mArenas)
+            if (a->layout() == layout)
+                return *a;
+
+        return *mArenas.emplace_back(std::make_unique<GeometryArena>(layout, ARENA_VERTICES, ARENA_INDICES));
+    }
+
+    static void assign(component::mesh& mesh, const GeometryArena::range& r) {
+        mesh.baseVertex = r.baseVertex;
+        mesh.firstIndex = r.firstIndex;
+        mesh.vertexCount = r.vertexCount;
+        mesh.indexCount = r.indexCount;
+        mesh.bIndices = 0 < r.indexCount;
+    }
+
+public:
+    // Singleton interface
+    static GeometryBuffer& get() {
+        static GeometryBuffer instance{};
+        return instance;
+    }
+
+    // Stores a mesh in the arena for layout. Leave indices empty for unindexed meshes.
+    component::mesh add(const std::vector<vertex>& vertices, const std::vector<unsigned int>& indices, const vertexformat::layout& layout, GLenum drawMode = GL_TRIANGLES) {
+        auto& a = arena(layout);
+        const auto handle = mNextHandle++;
+        component::mesh mesh{};
+        mesh.VAO = a.VAO();
+        mesh.geometry = handle;
+        mesh.drawMode = drawMode;
+        assign(mesh, a.add(handle, vertices, indices));
+        mHandles[handle] = &a;
+        return mesh;
+    }
+
+    void remove(component::mesh& mesh) {
+        auto it = mHandles.find(mesh.geometry);
+        if (it == mHandles.end())
+            return;
+
+        it->second->remove(mesh.geometry);
+        mHandles.erase(it);
+        mesh = component::mesh{};
+    }
+
+    // Arena holding a mesh, nullptr if it isn't stored here
+    const GeometryArena* arenaOf(const component::mesh& mesh) const {
+        const auto it = mHandles.find(mesh.geometry);
+        return it == mHandles.end() ? nullptr : it->second;
+    }
+
+    // Refreshes the offsets of a mesh (and any copies of it), needed after defragment()
+    void update(component::mesh& mesh) const {
+        auto it = mHandles.find(mesh.geometry);
+        if (it == mHandles.end())
+            return;
+
+        if (const auto r = it->second->find(mesh.geometry))
+            assign(mesh, *r);
+    }
+
+    // Compacts every arena. Returns the number of bytes copied.
+    GLsizeiptr defragment() {
+        GLsizeiptr copied{0};
+        for (auto& a : mArenas)
+            copied += a->defragment();
+        return copied;
+    }
+
+    stats getStats() const {
+        stats s{};
+        s.arenas = mArenas.size();
+        s.meshes = mHandles.size();
+        for (const auto& a : mArenas) {
+            const auto& v = a->vertexSpace();
+            const auto& i = a->indexSpace();
+            s.capacityBytes += static_cast<GLsizeiptr>(v.capacity()) * a->layout().stride + i.capacity() * sizeof(GLuint);
+            s.usedBytes += static_cast<GLsizeiptr>(v.capacity() - v.freeSpace()) * a->layout().stride + (i.capacity() - i.freeSpace()) * sizeof(GLuint);
+            s.freeBlocks += v.freeBlocks() + i.freeBlocks();
+        }
+        return s;
+    }
+
+    // Deletes all arenas. Every mesh handed out is invalid afterwards.
+    void clear() {
+        mArenas.clear();
+        mHandles.clear();
+    }
+};
+
+inline std::ostream& operator<<(std::ostream& os, const GeometryBuffer::stats& s) {
+    return os << s.meshes << " meshes in " << s.arenas << " arenas, " << s.usedBytes << " of " << s.capacityBytes
+        << " bytes used, " << s.freeBlocks << " free blocks";
+}
+
+#endif // GEOMETRYBUFFER_H
@@ -0,0 +1,145 @@
+#ifndef GLSTATE_H
+#define GLSTATE_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <array>
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+/**
+ * Shadow copy of the bound OpenGL state, so calls that wouldn't change anything are skipped.
+ * Programs, vertex arrays, framebuffers, textures, the viewport, capabilities and the blend
+ * function are all bound through here. Code changing any of these with raw GL calls
+ * has to call invalidate() afterwards, or later calls may be skipped wrongly.
+ * Only used from the GL thread.
+ */
+class GLState
+{
+public:
+    // Texture units tracked by bindTexture
+    static constexpr unsigned int TEXTURE_UNITS = 16;
+
+    struct counters
+    {
+        unsigned int issued{0};
+        unsigned int elided{0};
+    };
+
+private:
+    // Marks state that may be anything, like after invalidate()
+    static constexpr GLuint UNKNOWN = ~0u;
+
+    GLuint mProgram{UNKNOWN}, mVertexArray{UNKNOWN}, mDrawFramebuffer{UNKNOWN}, mReadFramebuffer{UNKNOWN};
+    std::array<GLuint, TEXTURE_UNITS> mTextures;
+    glm::ivec4 mViewport{-1};
+    std::pair<GLenum, GLenum> mBlendFunc{GL_NONE, GL_NONE};
+    // Capabilities with a known state
+    std::vector<std::pair<GLenum, bool>> mCapabilities;
+    counters mFrame{}, mLastFrame{};
+
+    GLState() { invalidate(); }
+
+    GLState(const GLState&) = delete;
+    GLState(GLState&&) = delete;
+    void operator=(const GLState&) = delete;
+    void operator=(GLState&&) = delete;
+
+    // Returns true if the call has to be issued
+    template <typename T>
+    bool change(T& current, const T& value) {
+        if (current == value) {
+            ++mFrame.elided;
+            return false;
+        }
+        current = value;
+        ++mFrame.issued;
+        return true;
+    }
+
+public:
+    // Singleton interface
+    static GLState& get() {
+        static GLState instance{};
+        return instance;
+    }
+
+    // Forgets all tracked state, so the next call of every kind is issued
+    void invalidate() {
+        mProgram = mVertexArray = mDrawFramebuffer = mReadFramebuffer = UNKNOWN;
+        mTextures.fill(UNKNOWN);
+        mViewport = glm::ivec4{-1};
+        mBlendFunc = {GL_NONE, GL_NONE};
+        mCapabilities.clear();
+    }
+
+    void useProgram(GLuint program) {
+        if (change(mProgram, program))
+            glUseProgram(program);
+    }
+
+    void bindVertexArray(GLuint vertexArray) {
+        if (change(mVertexArray, vertexArray))
+            glBindVertexArray(vertexArray);
+    }
+
+    // target is GL_FRAMEBUFFER (both), GL_DRAW_FRAMEBUFFER or GL_READ_FRAMEBUFFER
+    void bindFramebuffer(GLenum target, GLuint framebuffer) {
+        if (target == GL_FRAMEBUFFER) {
+            if (mDrawFramebuffer == framebuffer && mReadFramebuffer == framebuffer) {
+                ++mFrame.elided;
+                return;
+            }
+            mDrawFramebuffer = mReadFramebuffer = framebuffer;
+            ++mFrame.issued;
+            glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        } else if (change(target == GL_DRAW_FRAMEBUFFER ? mDrawFramebuffer : mReadFramebuffer, framebuffer)) {
+            glBindFramebuffer(target, framebuffer);
+        }
+    }
+
+    // Binds texture to unit with its own target (glBindTextureUnit), which leaves the active texture unit alone
+    void bindTexture(GLuint unit, GLuint texture) {
+        if (TEXTURE_UNITS <= unit) {
+            ++mFrame.issued;
+            glBindTextureUnit(unit, texture);
+        } else if (change(mTextures[unit], texture)) {
+            glBindTextureUnit(unit, texture);
+        }
+    }
+
+    void viewport(GLint x, GLint y, GLsizei width, GLsizei height) {
+        if (change(mViewport, glm::ivec4{x, y, width, height}))
+            glViewport(x, y, width, height);
+    }
+
+    void setEnabled(GLenum capability, bool bEnabled) {
+        auto it = std::find_if(mCapabilities.begin(), mCapabilities.end(), [&](const auto& c) { return c.first == capability; });
+        if (it == mCapabilities.end()) {
+            mCapabilities.emplace_back(capability, !bEnabled);
+            it = mCapabilities.end() - 1;
+        }
+        if (change(it->second, bEnabled))
+            bEnabled ? glEnable(capability) : glDisable(capability);
+    }
+
+    void enable(GLenum capability) { setEnabled(capability, true); }
+    void disable(GLenum capability) { setEnabled(capability, false); }
+
+    void blendFunc(GLenum source, GLenum destination) {
+        if (change(mBlendFunc, std::make_pair(source, destination)))
+            glBlendFunc(source, destination);
+    }
+
+    // Starts counting the calls of a new frame
+    void beginFrame() {
+        mLastFrame = mFrame;
+        mFrame = {};
+    }
+
+    // Calls issued and skipped during the last whole frame
+    counters lastFrame() const { return mLastFrame; }
+};
+
+#endif // GLSTATE_H
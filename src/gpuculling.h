@@ -0,0 +1,302 @@
+#ifndef GPUCULLING_H
+#define GPUCULLING_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <entt/entt.hpp>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <iostream>
+#include "components.h"
+#include "shader.h"
+#include "lod.h"
+#include "frustum.h"
+#include "occlusion.h"
+#include "uploadring.h"
+#include "glstate.h"
+#include "gpumemory.h"
+
+/**
+ * GPU driven culling and drawing of level of detail meshes.
+ * Every level lives in the same geometry arena (see geometrybuffer.h), which is drawn through
+ * a VAO of our own that adds the per instance object index. Each frame the objects
+ * are written to an SSBO and a compute pass (cull.comp) does frustum culling and level
+ * selection, writing one DrawElementsIndirectCommand per object. Objects are grouped
+ * by shader and every group is drawn with a single glMultiDrawElementsIndirect.
+ */
+class GpuCulling
+{
+public:
+    // Same layout as Object in objects.vert (std430)
+    struct object
+    {
+        glm::mat4 model;
+        glm::vec4 sphere;
+        glm::vec4 color;
+    };
+
+    // Same layout as DrawCommand in cull.comp
+    struct drawCommand
+    {
+        GLuint count;
+        GLuint instanceCount;
+        GLuint firstIndex;
+        GLint baseVertex;
+        GLuint baseInstance;
+    };
+
+private:
+    // Same layout as LodLevel in cull.comp
+    struct lodLevel
+    {
+        GLuint indexCount;
+        GLuint firstIndex;
+        GLint baseVertex;
+        float minScreenRadius;
+    };
+
+    // Objects [first, first + count) are drawn with shader
+    struct group
+    {
+        unsigned int shader;
+        GLuint first{0}, count{0};
+    };
+
+    Shader mCullShader;
+    // Reads the buffers of the arena holding the levels, plus the object indices
+    unsigned int mVAO{0};
+    const GeometryArena* mArena{nullptr};
+    // Arena generation the VAO points at, 0 before that (a built arena is past 0)
+    unsigned int mArenaGeneration{0};
+    // Instanced attribute turning the baseInstance of each command into the object index
+    unsigned int mObjectIndexBuffer{0};
+    unsigned int mLodBuffer{0}, mLodStateBuffer{0}, mCommandBuffer{0};
+    GLuint mLodCount{0};
+    float mHysteresis{0.f};
+    // Object slot order, grouped by shader
+    std::vector<entt::entity> mEntities;
+    std::vector<group> mGroups;
+    bool bCulled{false};
+
+    // Visible counts are read back once the GPU is done with them, a few frames late, so the CPU never waits for it
+    std::vector<unsigned int> mStatsBuffers;
+    std::vector<GLsync> mStatsFences;
+    unsigned int mStatsSlot{0};
+    GLuint mVisibleObjects{0}, mVisibleTriangles{0}, mCpuVisibleObjects{0};
+
+    // Returns false if the GPU isn't done with the current slot yet, the last counts are kept then
+    bool readStats() {
+        auto& fence = mStatsFences[mStatsSlot];
+        if (fence != nullptr) {
+            if (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0) == GL_TIMEOUT_EXPIRED)
+                return false;
+            glDeleteSync(fence);
+            fence = nullptr;
+
+            GLuint stats[2];
+            glGetNamedBufferSubData(mStatsBuffers[mStatsSlot], 0, sizeof(stats), stats);
+            mVisibleObjects = stats[0];
+            mVisibleTriangles = stats[1];
+        }
+        glClearNamedBufferData(mStatsBuffers[mStatsSlot], GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+        return true;
+    }
+
+    // The arena's vertices use binding point 0
+    static constexpr GLuint OBJECT_INDEX_LOCATION{4}, OBJECT_INDEX_BINDING{1};
+
+    // Points the VAO at the arena's current buffers, which change when it grows or is defragmented
+    void attachArena() {
+        if (mArena == nullptr || mArena->generation() == mArenaGeneration)
+            return;
+        mArenaGeneration = mArena->generation();
+        mArena->layout().attach(mVAO, mArena->vertexBuffer());
+        glVertexArrayElementBuffer(mVAO, mArena->indexBuffer());
+    }
+
+    void attachObjectIndices() const {
+        if (mObjectIndexBuffer == 0)
+            return;
+        glVertexArrayVertexBuffer(mVAO, OBJECT_INDEX_BINDING, mObjectIndexBuffer, 0, sizeof(GLuint));
+        glVertexArrayAttribIFormat(mVAO, OBJECT_INDEX_LOCATION, 1, GL_UNSIGNED_INT, 0);
+        glVertexArrayAttribBinding(mVAO, OBJECT_INDEX_LOCATION, OBJECT_INDEX_BINDING);
+        glVertexArrayBindingDivisor(mVAO, OBJECT_INDEX_BINDING, 1);
+        glEnableVertexArrayAttrib(mVAO, OBJECT_INDEX_LOCATION);
+    }
+
+public:
+    GpuCulling(const LodSet& lods, unsigned int framesInFlight = 3)
+        : mCullShader{Shader::compute("src/shaders/cull.comp")}, mStatsBuffers(framesInFlight, 0), mStatsFences(framesInFlight, nullptr)
+    {
+        glCreateVertexArrays(1, &mVAO);
+        glCreateBuffers(1, &mLodBuffer);
+        update(lods);
+
+        glCreateBuffers(framesInFlight, mStatsBuffers.data());
+        for (auto& b : mStatsBuffers)
+            GpuMemory::get().bufferStorage("GpuCulling", b, 2 * sizeof(GLuint), nullptr, 0);
+    }
+
+    GpuCulling(const GpuCulling&) = delete;
+    GpuCulling(GpuCulling&&) = delete;
+    void operator=(const GpuCulling&) = delete;
+    void operator=(GpuCulling&&) = delete;
+
+    // Reads the level offsets and thresholds from lods, again after GeometryBuffer::defragment()
+    void update(const LodSet& lods) {
+        std::vector<lodLevel> lodLevels{};
+        for (unsigned int i{0}; i < lods.size(); ++i) {
+            const auto& mesh = lods.mesh(i);
+            if (mesh.VAO != lods.mesh(0).VAO)
+                std::cout << "GpuCulling: level " << i << " is in another geometry arena than level 0 and can't be drawn." << std::endl;
+            lodLevels.push_back({mesh.indexCount, mesh.firstIndex, mesh.baseVertex, lods.minScreenRadius(i)});
+        }
+        mArena = lods.empty() ? nullptr : GeometryBuffer::get().arenaOf(lods.mesh(0));
+        mArenaGeneration = 0;
+        attachArena();
+        mLodCount = static_cast<GLuint>(lodLevels.size());
+        mHysteresis = lods.hysteresis();
+        GpuMemory::get().bufferData("GpuCulling", mLodBuffer, lodLevels.size() * sizeof(lodLevel), lodLevels.data(), GL_STATIC_DRAW);
+    }
+
+    /**
+     * Moves every entity with a level of detail and one of the given material shaders over to the GPU.
+     * shaders maps a material shader to the shader used for the GPU culled draws (see indirect.vert).
+     */
+    void build(entt::registry& EM, const std::vector<std::pair<unsigned int, unsigned int>>& shaders) {
+        mEntities.clear();
+        mGroups.clear();
+        auto view = EM.view<component::lod, component::world, component::mat>();
+        for (const auto& [materialShader, drawShader] : shaders) {
+            group g{drawShader, static_cast<GLuint>(mEntities.size())};
+            for (auto entity : view) {
+                auto [lod, material] = view.get<component::lod, component::mat>(entity);
+                if (static_cast<unsigned int>(material.shader) != materialShader)
+                    continue;
+
+                lod.bGpuCulled = true;
+                mEntities.push_back(entity);
+                ++g.count;
+            }
+            mGroups.push_back(g);
+        }
+
+        const auto count = static_cast<GLuint>(mEntities.size());
+        GpuMemory::get().deleteBuffers(1, &mObjectIndexBuffer);
+        GpuMemory::get().deleteBuffers(1, &mLodStateBuffer);
+        GpuMemory::get().deleteBuffers(1, &mCommandBuffer);
+
+        std::vector<GLuint> objectIndices(count);
+        for (GLuint i{0}; i < count; ++i)
+            objectIndices[i] = i;
+        glCreateBuffers(1, &mObjectIndexBuffer);
+        GpuMemory::get().bufferStorage("GpuCulling", mObjectIndexBuffer, count * sizeof(GLuint), objectIndices.data(), 0);
+        attachObjectIndices();
+
+        const std::vector<GLuint> lodState(count, 0);
+        glCreateBuffers(1, &mLodStateBuffer);
+        GpuMemory::get().bufferStorage("GpuCulling", mLodStateBuffer, count * sizeof(GLuint), lodState.data(), 0);
+        glCreateBuffers(1, &mCommandBuffer);
+        GpuMemory::get().bufferStorage("GpuCulling", mCommandBuffer, count * sizeof(drawCommand), nullptr, 0);
+    }
+
+    // Writes this frame's objects and dispatches the culling pass. Objects hidden in occlusion are left out up front.
+    void cull(entt::registry& EM, UploadRing& ring, const component::camera& camera, const glm::vec3& cameraPos, int screenHeight, const OcclusionBuffer* occlusion = nullptr) {
+        bCulled = false;
+        if (mEntities.empty())
+            return;
+
+        const bool bCountStats = readStats();
+
+        auto block = ring.allocate(mEntities.size() * sizeof(object), GL_SHADER_STORAGE_BUFFER);
+        if (!block)
+            return;
+
+        attachArena();
+
+        // Same test on the CPU, to validate the GPU count against
+        const auto f = frustum::fromMatrix(camera.proj * camera.view);
+        mCpuVisibleObjects = 0;
+        auto objects = reinterpret_cast<object*>(block.ptr);
+        for (std::size_t i{0}; i < mEntities.size(); ++i) {
+            const auto& [world, material] = EM.get<component::world, component::mat>(mEntities[i]);
+            const auto radius = world.maxScale();
+            const bool bDrawn = material.bDrawn && (occlusion == nullptr || occlusion->visible(world.pos(), radius));
+            objects[i] = {world.mat, glm::vec4{world.pos(), bDrawn ? radius : -1.f}, glm::vec4{material.color, 1.f}};
+            if (bDrawn && f.intersects(world.pos(), radius))
+                ++mCpuVisibleObjects;
+        }
+        ring.bindRange(GL_SHADER_STORAGE_BUFFER, 3, block);
+
+        const auto s = mCullShader.get();
+        GLState::get().useProgram(s);
+        glUniform1ui(glGetUniformLocation(s, "objectCount"), static_cast<GLuint>(mEntities.size()));
+        glUniform1ui(glGetUniformLocation(s, "lodCount"), mLodCount);
+        glUniform4fv(glGetUniformLocation(s, "frustumPlanes"), 6, glm::value_ptr(f.planes[0]));
+        glUniform3fv(glGetUniformLocation(s, "cameraPos"), 1, glm::value_ptr(cameraPos));
+        glUniform1f(glGetUniformLocation(s, "screenHeight"), static_cast<float>(screenHeight));
+        glUniform1f(glGetUniformLocation(s, "hysteresis"), mHysteresis);
+        glUniform1i(glGetUniformLocation(s, "countStats"), bCountStats);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, mLodBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, mLodStateBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, mCommandBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, mStatsBuffers[mStatsSlot]);
+        glDispatchCompute((static_cast<GLuint>(mEntities.size()) + 63) / 64, 1, 1);
+        // Commands are read as indirect draws and the stats by glGetBufferSubData
+        glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+        // A slot still in flight keeps its fence and is tried again next frame
+        if (bCountStats) {
+            mStatsFences[mStatsSlot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            mStatsSlot = (mStatsSlot + 1) % mStatsBuffers.size();
+        }
+        bCulled = true;
+    }
+
+    /**
+     * Draws the objects culled this frame, one glMultiDrawElementsIndirect per group.
+     * useShader(shader) is called before each group to bind and set up its shader.
+     */
+    template <typename F>
+    void draw(F&& useShader) const {
+        if (!bCulled || mArena == nullptr)
+            return;
+
+        GLState::get().bindVertexArray(mVAO);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, mCommandBuffer);
+        for (const auto& g : mGroups) {
+            if (g.count == 0)
+                continue;
+
+            useShader(g.shader);
+            glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void *)(g.first * sizeof(drawCommand)), g.count, 0);
+        }
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    }
+
+    std::size_t objectCount() const { return mEntities.size(); }
+    // Counted on the GPU, a few frames old
+    GLuint visibleObjects() const { return mVisibleObjects; }
+    GLuint visibleTriangles() const { return mVisibleTriangles; }
+    // Counted on the CPU this frame
+    GLuint cpuVisibleObjects() const { return mCpuVisibleObjects; }
+
+    ~GpuCulling() {
+        for (auto& fence : mStatsFences)
+            if (fence != nullptr)
+                glDeleteSync(fence);
+        GpuMemory::get().deleteBuffers(static_cast<GLsizei>(mStatsBuffers.size()), mStatsBuffers.data());
+
+        glDeleteVertexArrays(1, &mVAO);
+        // Deleting the VAO unbinds it
+        GLState::get().invalidate();
+        GpuMemory::get().deleteBuffers(1, &mObjectIndexBuffer);
+        GpuMemory::get().deleteBuffers(1, &mCommandBuffer);
+        GpuMemory::get().deleteBuffers(1, &mLodStateBuffer);
+        GpuMemory::get().deleteBuffers(1, &mLodBuffer);
+    }
+};
+
+#endif // GPUCULLING_H
@@ -0,0 +1,183 @@
+#ifndef GPUMEMORY_H
+#define GPUMEMORY_H
+
+#include <glad/glad.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+#include <cstdint>
+
+/**
+ * Accounts for the GPU memory of every buffer, texture and renderbuffer, tagged by the subsystem owning it.
+ * Storage is allocated and objects deleted through here instead of the GL calls, which keeps
+ * the live bytes per tag and in total along with their peaks. Exceeding the budget prints
+ * a warning with the breakdown. Sizes are what we asked for, the driver may add padding.
+ * Only used from the GL thread.
+ */
+class GpuMemory
+{
+private:
+    enum class kind : std::uint64_t { BUFFER, TEXTURE, RENDERBUFFER };
+
+    struct allocation
+    {
+        std::string tag;
+        std::int64_t bytes;
+    };
+
+    struct usage
+    {
+        std::int64_t bytes{0};
+        std::int64_t peak{0};
+        unsigned int count{0};
+    };
+
+    std::unordered_map<std::uint64_t, allocation> mAllocations;
+    std::unordered_map<std::string, usage> mTags;
+    usage mTotal{};
+    std::int64_t mBudget{0};
+    bool bOverBudget{false};
+
+    GpuMemory() = default;
+
+    GpuMemory(const GpuMemory&) = delete;
+    GpuMemory(GpuMemory&&) = delete;
+    void operator=(const GpuMemory&) = delete;
+    void operator=(GpuMemory&&) = delete;
+
+    static std::uint64_t key(kind k, GLuint name) { return (static_cast<std::uint64_t>(k) << 32) | name; }
+
+    // Bytes per texel of the internal formats in use, anything else counts as 4
+    static std::int64_t texelBytes(GLenum internalFormat) {
+        switch (internalFormat) {
+            case GL_R8: return 1;
+            case GL_RG8: case GL_R16F: return 2;
+            case GL_RGBA16F: case GL_RG32F: return 8;
+            case GL_RGB16F: return 6;
+            case GL_RGB32F: return 12;
+            case GL_RGBA32F: return 16;
+            case GL_DEPTH32F_STENCIL8: return 5;
+            default: return 4;
+        }
+    }
+
+    void add(kind k, GLuint name, const char* tag, std::int64_t bytes) {
+        remove(k, name);
+        mAllocations[key(k, name)] = {tag, bytes};
+        auto& t = mTags[tag];
+        t.bytes += bytes;
+        t.peak = std::max(t.peak, t.bytes);
+        ++t.count;
+        mTotal.bytes += bytes;
+        mTotal.peak = std::max(mTotal.peak, mTotal.bytes);
+        ++mTotal.count;
+
+        if (0 < mBudget && mBudget < mTotal.bytes && !bOverBudget) {
+            bOverBudget = true;
+            std::cout << "GpuMemory: " << megabytes(mTotal.bytes) << " MB is over the budget of " << megabytes(mBudget)
+                << " MB after allocating " << megabytes(bytes) << " MB for " << tag << "." << std::endl;
+            report(std::cout);
+        }
+    }
+
+    void remove(kind k, GLuint name) {
+        auto it = mAllocations.find(key(k, name));
+        if (it == mAllocations.end())
+            return;
+
+        auto& t = mTags[it->second.tag];
+        t.bytes -= it->second.bytes;
+        --t.count;
+        mTotal.bytes -= it->second.bytes;
+        --mTotal.count;
+        mAllocations.erase(it);
+        // Warn again the next time it's exceeded
+        if (mTotal.bytes <= mBudget)
+            bOverBudget = false;
+    }
+
+    static double megabytes(std::int64_t bytes) { return bytes / (1024.0 * 1024.0); }
+
+public:
+    // Singleton interface
+    static GpuMemory& get() {
+        static GpuMemory instance{};
+        return instance;
+    }
+
+    // Warns when more than bytes are allocated, 0 turns the warning off
+    void setBudget(std::int64_t bytes) {
+        mBudget = bytes;
+        bOverBudget = 0 < mBudget && mBudget < mTotal.bytes;
+    }
+
+    // glNamedBufferStorage, the buffer must be created (glCreateBuffers or bound once)
+    void bufferStorage(const char* tag, GLuint buffer, GLsizeiptr size, const void* data, GLbitfield flags) {
+        glNamedBufferStorage(buffer, size, data, flags);
+        add(kind::BUFFER, buffer, tag, size);
+    }
+
+    // glNamedBufferData, replaces the size of an earlier allocation of the buffer
+    void bufferData(const char* tag, GLuint buffer, GLsizeiptr size, const void* data, GLenum usage) {
+        glNamedBufferData(buffer, size, data, usage);
+        add(kind::BUFFER, buffer, tag, size);
+    }
+
+    // glTextureStorage2D, counting every mip level
+    void textureStorage2D(const char* tag, GLuint texture, GLsizei levels, GLenum internalFormat, GLsizei width, GLsizei height) {
+        glTextureStorage2D(texture, levels, internalFormat, width, height);
+        std::int64_t texels{0};
+        for (GLsizei i{0}; i < levels; ++i)
+            texels += static_cast<std::int64_t>(std::max(width >> i, 1)) * std::max(height >> i, 1);
+        add(kind::TEXTURE, texture, tag, texels * texelBytes(internalFormat));
+    }
+
+    void renderbufferStorage(const char* tag, GLuint renderbuffer, GLenum internalFormat, GLsizei width, GLsizei height) {
+        glNamedRenderbufferStorage(renderbuffer, internalFormat, width, height);
+        add(kind::RENDERBUFFER, renderbuffer, tag, static_cast<std::int64_t>(width) * height * texelBytes(internalFormat));
+    }
+
+    void deleteBuffers(GLsizei n, const GLuint* buffers) {
+        for (GLsizei i{0}; i < n; ++i)
+            remove(kind::BUFFER, buffers[i]);
+        glDeleteBuffers(n, buffers);
+    }
+
+    void deleteTextures(GLsizei n, const GLuint* textures) {
+        for (GLsizei i{0}; i < n; ++i)
+            remove(kind::TEXTURE, textures[i]);
+        glDeleteTextures(n, textures);
+    }
+
+    void deleteRenderbuffers(GLsizei n, const GLuint* renderbuffers) {
+        for (GLsizei i{0}; i < n; ++i)
+            remove(kind::RENDERBUFFER, renderbuffers[i]);
+        glDeleteRenderbuffers(n, renderbuffers);
+    }
+
+    std::int64_t bytes() const { return mTotal.bytes; }
+    std::int64_t peak() const { return mTotal.peak; }
+    std::int64_t budget() const { return mBudget; }
+
+    // Writes live and peak memory per tag, largest first
+    void report(std::ostream& os) const {
+        std::vector<std::pair<std::string, usage>> tags{mTags.begin(), mTags.end()};
+        std::sort(tags.begin(), tags.end(), [](const auto& a, const auto& b) { return a.second.bytes > b.second.bytes; });
+
+        const auto flags = os.flags();
+        const auto precision = os.precision(2);
+        os << std::fixed << "GPU memory (MB, live/peak/objects):" << std::endl;
+        for (const auto& [tag, u] : tags)
+            os << "  " << std::left << std::setw(16) << tag << std::right << std::setw(10) << megabytes(u.bytes)
+                << std::setw(10) << megabytes(u.peak) << std::setw(8) << u.count << std::endl;
+        os << "  " << std::left << std::setw(16) << "total" << std::right << std::setw(10) << megabytes(mTotal.bytes)
+            << std::setw(10) << megabytes(mTotal.peak) << std::setw(8) << mTotal.count << std::endl;
+        os.flags(flags);
+        os.precision(precision);
+    }
+};
+
+#endif // GPUMEMORY_H
@@ -0,0 +1,157 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include <glad/glad.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <utility>
+#include "glstate.h"
+#include "gpumemory.h"
+
+#if __has_include(<EGL/egl.h>)
+// Keeps X11 macros out of the EGL headers
+#define EGL_NO_X11
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#define HEADLESS_EGL
+#endif
+
+/**
+ * OpenGL context without a window, for render farms and automated perf tests.
+ * Uses EGL with the Mesa surfaceless platform (works with llvmpipe and GPU drivers
+ * alike), falling back to the default EGL display. Since there is no default
+ * framebuffer, rendering ends up in an offscreen target created with createTarget().
+ */
+class HeadlessContext
+{
+private:
+#ifdef HEADLESS_EGL
+    EGLDisplay mDisplay{EGL_NO_DISPLAY};
+    EGLContext mContext{EGL_NO_CONTEXT};
+#endif
+    unsigned int mFramebuffer{0}, mColor{0};
+    GLsizei mWidth{0}, mHeight{0};
+
+public:
+    HeadlessContext() {
+#ifdef HEADLESS_EGL
+#ifdef EGL_PLATFORM_SURFACELESS_MESA
+        const auto getPlatformDisplay = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(eglGetProcAddress("eglGetPlatformDisplayEXT"));
+        if (getPlatformDisplay != nullptr)
+            mDisplay = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+#endif
+        if (mDisplay == EGL_NO_DISPLAY)
+            mDisplay = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+        EGLint major, minor;
+        if (mDisplay == EGL_NO_DISPLAY || !eglInitialize(mDisplay, &major, &minor)) {
+            std::cout << "HeadlessContext: failed to initialize EGL." << std::endl;
+            mDisplay = EGL_NO_DISPLAY;
+            return;
+        }
+        eglBindAPI(EGL_OPENGL_API);
+
+        // Software rasterizers may stop at 4.5. The renderer sticks to 4.5 core, GPU culled draws
+        // included (indirect.vert finds its object without the 4.6 gl_BaseInstance), so that's enough
+        for (const EGLint glMinor : {6, 5}) {
+            const EGLint attributes[]{
+                EGL_CONTEXT_MAJOR_VERSION, 4,
+                EGL_CONTEXT_MINOR_VERSION, glMinor,
+                EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+                EGL_NONE
+            };
+            // No config needed without surfaces (EGL_KHR_no_config_context)
+            mContext = eglCreateContext(mDisplay, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, attributes);
+            if (mContext != EGL_NO_CONTEXT)
+                break;
+        }
+
+        if (mContext == EGL_NO_CONTEXT || !eglMakeCurrent(mDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, mContext)) {
+            std::cout << "HeadlessContext: failed to create a surfaceless OpenGL 4.5+ core context (EGL " << major << "." << minor << ")." << std::endl;
+            return;
+        }
+#else
+        std::cout << "HeadlessContext: built without EGL, headless rendering is unavailable." << std::endl;
+#endif
+    }
+
+    HeadlessContext(const HeadlessContext&) = delete;
+    HeadlessContext(HeadlessContext&&) = delete;
+    void operator=(const HeadlessContext&) = delete;
+    void operator=(HeadlessContext&&) = delete;
+
+    bool valid() const {
+#ifdef HEADLESS_EGL
+        return mContext != EGL_NO_CONTEXT;
+#else
+        return false;
+#endif
+    }
+
+    // Loader for gladLoadGLLoader
+    static void* procAddress(const char* name) {
+#ifdef HEADLESS_EGL
+        return reinterpret_cast<void*>(eglGetProcAddress(name));
+#else
+        return nullptr;
+#endif
+    }
+
+    // Creates the framebuffer standing in for the window. Needs a loaded context.
+    void createTarget(GLsizei width, GLsizei height) {
+        mWidth = width;
+        mHeight = height;
+        glCreateRenderbuffers(1, &mColor);
+        GpuMemory::get().renderbufferStorage("Headless", mColor, GL_RGBA8, width, height);
+        glCreateFramebuffers(1, &mFramebuffer);
+        glNamedFramebufferRenderbuffer(mFramebuffer, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, mColor);
+        if (glCheckNamedFramebufferStatus(mFramebuffer, GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "HeadlessContext: offscreen framebuffer is incomplete." << std::endl;
+    }
+
+    unsigned int framebuffer() const { return mFramebuffer; }
+
+    // Writes the offscreen framebuffer as a binary PPM image
+    bool writeImage(const std::string& file) const {
+        std::vector<unsigned char> pixels(static_cast<std::size_t>(mWidth) * mHeight * 3);
+        glNamedFramebufferReadBuffer(mFramebuffer, GL_COLOR_ATTACHMENT0);
+        GLState::get().bindFramebuffer(GL_READ_FRAMEBUFFER, mFramebuffer);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glReadPixels(0, 0, mWidth, mHeight, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+        GLState::get().bindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+
+        std::ofstream ofs{file, std::ios::binary};
+        if (!ofs) {
+            std::cout << "HeadlessContext couldn't open " << file << " for writing." << std::endl;
+            return false;
+        }
+
+        // PPM rows go top to bottom
+        ofs << "P6\n" << mWidth << " " << mHeight << "\n255\n";
+        const auto row = static_cast<std::size_t>(mWidth) * 3;
+        for (auto y{mHeight}; 0 < y--;)
+            ofs.write(reinterpret_cast<const char*>(pixels.data() + y * row), row);
+
+        std::cout << "Wrote " << mWidth << "x" << mHeight << " image to " << file << std::endl;
+        return true;
+    }
+
+    ~HeadlessContext() {
+        if (mFramebuffer != 0) {
+            glDeleteFramebuffers(1, &mFramebuffer);
+            GpuMemory::get().deleteRenderbuffers(1, &mColor);
+        }
+#ifdef HEADLESS_EGL
+        if (mDisplay != EGL_NO_DISPLAY) {
+            eglMakeCurrent(mDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+            if (mContext != EGL_NO_CONTEXT)
+                eglDestroyContext(mDisplay, mContext);
+            eglTerminate(mDisplay);
+        }
+#endif
+    }
+};
+
+#endif // HEADLESS_H
@@ -0,0 +1,128 @@
+#ifndef IMPOSTORS_H
+#define IMPOSTORS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <entt/entt.hpp>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <cstring>
+#include "components.h"
+#include "frustum.h"
+#include "uploadring.h"
+#include "glstate.h"
+
+/**
+ * Draws spheres (entities with a component::lod) as one camera facing quad each instead of a mesh.
+ * The fragment shaders ray cast the exact sphere behind the quad and write its depth
+ * (see impostor.vert and sphereraycast.vert), so silhouettes are round at any size and
+ * a sphere costs 4 vertices. Each material shader with an impostor version is drawn
+ * with one instanced draw call.
+ * Spheres the camera nearly touches are left to their meshes, as their quad would cross the near plane.
+ */
+class SphereImpostors
+{
+public:
+    // Same layout as Impostor in impostor.vert (std430)
+    struct instance
+    {
+        glm::vec4 sphere;
+        glm::vec4 color;
+    };
+
+    // Must match the binding in impostor.vert
+    static constexpr unsigned int INSTANCE_BINDING = 10;
+    // Spheres closer to the camera than this many near plane distances are drawn as meshes
+    static constexpr float MIN_NEAR_DISTANCES = 2.f;
+
+private:
+    struct group
+    {
+        unsigned int materialShader;
+        unsigned int drawShader;
+        std::vector<instance> instances;
+    };
+
+    std::vector<group> mGroups;
+    unsigned int mVAO{0};
+    std::size_t mDrawn{0};
+
+public:
+    // shaders pairs every material shader with the impostor shader drawing it
+    SphereImpostors(const std::vector<std::pair<unsigned int, unsigned int>>& shaders) {
+        for (const auto& [materialShader, drawShader] : shaders)
+            mGroups.push_back({materialShader, drawShader, {}});
+        // Core profile draws need a vertex array, even without attributes
+        glCreateVertexArrays(1, &mVAO);
+    }
+
+    SphereImpostors(const SphereImpostors&) = delete;
+    SphereImpostors(SphereImpostors&&) = delete;
+    void operator=(const SphereImpostors&) = delete;
+    void operator=(SphereImpostors&&) = delete;
+
+    // True if spheres with this material shader can be drawn as impostors
+    bool handles(unsigned int materialShader) const {
+        return std::any_of(mGroups.begin(), mGroups.end(), [&](const group& g) { return g.materialShader == materialShader; });
+    }
+
+    // True if the sphere is far enough from the camera to be drawn as an impostor
+    static bool drawable(const glm::vec3& center, float radius, const glm::vec3& cameraPos, float zNear) {
+        return MIN_NEAR_DISTANCES * zNear < glm::distance(center, cameraPos) - radius;
+    }
+
+    /**
+     * Draws every visible sphere with an impostor shader.
+     * visible(center, radius) can hide more spheres, like ones behind occluders.
+     * useShader(shader) is called before each group to bind and set up its shader.
+     * Returns the number of triangles drawn.
+     */
+    template <typename V, typename F>
+    unsigned int draw(entt::registry& EM, UploadRing& ring, const component::camera& camera, const glm::vec3& cameraPos, V&& visible, F&& useShader) {
+        for (auto& g : mGroups)
+            g.instances.clear();
+
+        const auto f = frustum::fromMatrix(camera.proj * camera.view);
+        const auto zNear = camera.proj[3][2] / (camera.proj[2][2] - 1.f);
+        EM.view<component::world, component::mat, component::lod>().each([&](auto entity, const component::world& world, const component::mat& material, const component::lod&) {
+            auto g = std::find_if(mGroups.begin(), mGroups.end(), [&](const group& candidate) { return candidate.materialShader == static_cast<unsigned int>(material.shader); });
+            if (!material.bDrawn || g == mGroups.end())
+                return;
+
+            const auto center = world.pos();
+            const auto radius = world.maxScale();
+            if (!drawable(center, radius, cameraPos, zNear) || !f.intersects(center, radius) || !visible(center, radius))
+                return;
+            g->instances.push_back({glm::vec4{center, radius}, glm::vec4{material.color, 1.f}});
+        });
+
+        mDrawn = 0;
+        GLState::get().bindVertexArray(mVAO);
+        for (const auto& g : mGroups) {
+            if (g.instances.empty())
+                continue;
+
+            const auto bytes = g.instances.size() * sizeof(instance);
+            auto block = ring.allocate(bytes, GL_SHADER_STORAGE_BUFFER);
+            if (!block)
+                continue;
+            std::memcpy(block.ptr, g.instances.data(), bytes);
+            ring.bindRange(GL_SHADER_STORAGE_BUFFER, INSTANCE_BINDING, block);
+
+            useShader(g.drawShader);
+            glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, static_cast<GLsizei>(g.instances.size()));
+            mDrawn += g.instances.size();
+        }
+        return static_cast<unsigned int>(mDrawn * 2);
+    }
+
+    // Spheres drawn by the last draw
+    std::size_t drawn() const { return mDrawn; }
+
+    ~SphereImpostors() {
+        glDeleteVertexArrays(1, &mVAO);
+    }
+};
+
+#endif // IMPOSTORS_H
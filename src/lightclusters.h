@@ -0,0 +1,126 @@
+#ifndef LIGHTCLUSTERS_H
+#define LIGHTCLUSTERS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <entt/entt.hpp>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include "components.h"
+#include "shader.h"
+#include "uploadring.h"
+#include "glstate.h"
+#include "gpumemory.h"
+
+/**
+ * Clustered shading for many point lights.
+ * The view frustum is split into screen tiles of TILE_SIZE pixels and DEPTH_SLICES
+ * exponential depth slices. Every frame the lights (entities with a component::light)
+ * are written to an SSBO and a compute pass (lights.comp) lists the lights touching
+ * each cluster, so phong.frag only loops over the lights of its own cluster.
+ * A cluster holds at most LIGHTS_PER_CLUSTER lights, any more are left out.
+ */
+class LightClusters
+{
+public:
+    // Same layout as Light in lightgrid.vert (std430)
+    struct light
+    {
+        glm::vec4 posRadius;
+        glm::vec4 color;
+    };
+
+    static constexpr unsigned int TILE_SIZE = 64;
+    static constexpr unsigned int DEPTH_SLICES = 16;
+    static constexpr unsigned int LIGHTS_PER_CLUSTER = 32;
+    // Must match the bindings in lightgrid.vert
+    static constexpr unsigned int GRID_UBO_BINDING = 1;
+    static constexpr unsigned int LIGHT_BINDING = 8;
+    static constexpr unsigned int CLUSTER_BINDING = 9;
+
+private:
+    // Same layout as LightGrid in lightgrid.vert (std140)
+    struct gridBlock
+    {
+        glm::uvec4 grid;
+        glm::vec4 depth;
+    };
+
+    Shader mCullShader;
+    unsigned int mClusterBuffer{0};
+    std::size_t mClusterCapacity{0};
+    glm::uvec3 mGrid{0u};
+    std::vector<light> mLights;
+
+public:
+    LightClusters()
+        : mCullShader{Shader::compute("src/shaders/lights.comp")}
+    {}
+
+    LightClusters(const LightClusters&) = delete;
+    LightClusters(LightClusters&&) = delete;
+    void operator=(const LightClusters&) = delete;
+    void operator=(LightClusters&&) = delete;
+
+    /**
+     * Writes this frame's lights and dispatches the binning pass, then binds the buffers phong.frag reads.
+     * Expects this frame's camera block to be bound.
+     */
+    void update(entt::registry& EM, UploadRing& ring, const component::camera& camera, const glm::ivec2& screenSize) {
+        mGrid = {(screenSize.x + TILE_SIZE - 1) / TILE_SIZE, (screenSize.y + TILE_SIZE - 1) / TILE_SIZE, DEPTH_SLICES};
+        const std::size_t clusterCount = mGrid.x * mGrid.y * mGrid.z;
+        if (mClusterCapacity < clusterCount) {
+            GpuMemory::get().deleteBuffers(1, &mClusterBuffer);
+            glCreateBuffers(1, &mClusterBuffer);
+            GpuMemory::get().bufferStorage("LightClusters", mClusterBuffer, clusterCount * (LIGHTS_PER_CLUSTER + 1) * sizeof(GLuint), nullptr, 0);
+            mClusterCapacity = clusterCount;
+        }
+
+        mLights.clear();
+        EM.view<component::world, component::light>().each([&](auto ent, const component::world& world, const component::light& l) {
+            mLights.push_back({glm::vec4{world.pos(), l.radius}, glm::vec4{l.color, 1.f}});
+        });
+
+        // Near and far plane from the projection's depth terms
+        const auto& proj = camera.proj;
+        const auto zNear = proj[3][2] / (proj[2][2] - 1.f);
+        const auto zFar = proj[3][2] / (proj[2][2] + 1.f);
+
+        auto gridData = ring.allocate(sizeof(gridBlock));
+        // Always at least one light, as empty ranges can't be bound
+        auto lightBlock = ring.allocate(std::max<std::size_t>(mLights.size(), 1) * sizeof(light), GL_SHADER_STORAGE_BUFFER);
+        if (!gridData || !lightBlock)
+            return;
+
+        const gridBlock grid{{mGrid, LIGHTS_PER_CLUSTER}, {zNear, zFar, std::log(zFar / zNear), static_cast<float>(TILE_SIZE)}};
+        std::memcpy(gridData.ptr, &grid, sizeof(grid));
+        if (!mLights.empty())
+            std::memcpy(lightBlock.ptr, mLights.data(), mLights.size() * sizeof(light));
+        ring.bindRange(GL_UNIFORM_BUFFER, GRID_UBO_BINDING, gridData);
+        ring.bindRange(GL_SHADER_STORAGE_BUFFER, LIGHT_BINDING, lightBlock);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CLUSTER_BINDING, mClusterBuffer);
+
+        const auto s = mCullShader.get();
+        const auto invProj = glm::inverse(proj);
+        const glm::vec2 size{screenSize};
+        GLState::get().useProgram(s);
+        glUniform1ui(glGetUniformLocation(s, "lightCount"), static_cast<GLuint>(mLights.size()));
+        glUniform2fv(glGetUniformLocation(s, "screenSize"), 1, glm::value_ptr(size));
+        glUniformMatrix4fv(glGetUniformLocation(s, "invProj"), 1, GL_FALSE, glm::value_ptr(invProj));
+        glDispatchCompute((static_cast<GLuint>(clusterCount) + 63) / 64, 1, 1);
+        // Clusters are read by the fragment shaders
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    }
+
+    std::size_t lightCount() const { return mLights.size(); }
+    glm::uvec3 grid() const { return mGrid; }
+
+    ~LightClusters() {
+        GpuMemory::get().deleteBuffers(1, &mClusterBuffer);
+    }
+};
+
+#endif // LIGHTCLUSTERS_H
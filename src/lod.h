@@ -0,0 +1,106 @@
+#ifndef LOD_H
+#define LOD_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <vector>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include "components.h"
+#include "meshprocessing.h"
+#include "vertexformat.h"
+#include "geometrybuffer.h"
+
+/**
+ * A set of the same mesh generated at different resolutions.
+ * Level 0 is the most detailed mesh and every following level is coarser.
+ * A level is picked from how large (in pixels) the object appears on screen.
+ */
+class LodSet
+{
+public:
+    struct level
+    {
+        component::mesh mesh;
+        // Smallest projected radius (in pixels) this level should be used for
+        float minScreenRadius{0.f};
+    };
+
+private:
+    std::vector<level> mLevels;
+    // How far (relative) a radius must cross a threshold before switching level, to avoid popping.
+    float mHysteresis{0.2f};
+
+public:
+    LodSet() = default;
+
+    /**
+     * Uploads one indexed mesh per level, ordered from finest to coarsest.
+     * minScreenRadii[i] is the smallest projected radius (in pixels) level i is used for.
+     * Every level gets the same vertex layout, so they all end up in the same geometry arena.
+     */
+    LodSet(const std::vector<meshproc::container>& levels, const std::vector<float>& minScreenRadii, vertexformat::preset format = vertexformat::preset::FLOAT) {
+        std::vector<vertex> allVertices{};
+        for (const auto& level : levels)
+            allVertices.insert(allVertices.end(), level.first.begin(), level.first.end());
+        const auto layout = vertexformat::select(format, allVertices);
+
+        for (unsigned int i{0}; i < levels.size(); ++i)
+            mLevels.push_back({GeometryBuffer::get().add(levels[i].first, levels[i].second, layout), i < minScreenRadii.size() ? minScreenRadii[i] : 0.f});
+
+        // Coarsest level should always be selectable
+        if (!mLevels.empty())
+            mLevels.back().minScreenRadius = 0.f;
+    }
+
+    /**
+     * Projected radius in pixels of a sphere with the given world space center and radius.
+     * Uses the vertical focal length stored in the projection matrix.
+     */
+    static float screenRadius(const glm::vec3& center, float radius, const glm::vec3& cameraPos, const glm::mat4& proj, int screenHeight) {
+        const auto d = center - cameraPos;
+        const auto distSquared = glm::dot(d, d) - radius * radius;
+        // Camera is inside the sphere
+        if (distSquared <= 0.f)
+            return std::numeric_limits<float>::max();
+
+        return radius * proj[1][1] / std::sqrt(distSquared) * screenHeight * 0.5f;
+    }
+
+    // Finds the level for a projected radius, only leaving the current level once the radius is clearly outside it.
+    unsigned int select(float radius, unsigned int current) const {
+        if (mLevels.empty())
+            return 0;
+
+        current = std::min(current, static_cast<unsigned int>(mLevels.size() - 1));
+        while (0 < current && mLevels[current - 1].minScreenRadius * (1.f + mHysteresis) <= radius)
+            --current;
+        while (current + 1 < mLevels.size() && radius < mLevels[current].minScreenRadius * (1.f - mHysteresis))
+            ++current;
+
+        return current;
+    }
+
+    const component::mesh& mesh(unsigned int level) const { return mLevels.at(level).mesh; }
+    std::size_t size() const { return mLevels.size(); }
+    bool empty() const { return mLevels.empty(); }
+
+    float minScreenRadius(unsigned int level) const { return mLevels.at(level).minScreenRadius; }
+    float hysteresis() const { return mHysteresis; }
+    void setHysteresis(float hysteresis) { mHysteresis = hysteresis; }
+
+    // Picks up new offsets after GeometryBuffer::defragment()
+    void update() {
+        for (auto& l : mLevels)
+            GeometryBuffer::get().update(l.mesh);
+    }
+
+    void deInit() {
+        for (auto& l : mLevels)
+            GeometryBuffer::get().remove(l.mesh);
+        mLevels.clear();
+    }
+};
+
+#endif // LOD_H
@@ -1,11 +1,46 @@
 #include "app.h"
 #include <cstdlib> // For std::rand() and std::srand()
 #include <ctime> // For std::time();
+#include <string>
+#include <cctype>
 
-int main()
+/**
+ * Options:
+ * --headless <frames>  Render the given number of frames without a window and write the frame times
+ * --image <file.ppm>   Write the last headless frame as an image
+ * --capture <prefix>   Write every frame as <prefix>_00000.ppm, <prefix>_00001.ppm, ...
+ * --bloom <method>     Blur bloom with gaussian (ping-pong passes), dual (dual filter pyramid) or compute (compute shaders)
+ */
+int main(int argc, char* argv[])
 {
-    // Seed randomness
-    std::srand(std::time(nullptr));
-    App app{};
+    AppOptions options{};
+    for (int i{1}; i < argc; ++i)
+    {
+        const std::string arg{argv[i]};
+        if (arg == "--headless")
+            options.headlessFrames = (i + 1 < argc && std::isdigit(argv[i + 1][0])) ? std::stoul(argv[++i]) : 100;
+        else if (arg == "--image" && i + 1 < argc)
+            options.imageFile = argv[++i];
+        else if (arg == "--capture" && i + 1 < argc)
+            options.capturePrefix = argv[++i];
+        else if (arg == "--bloom" && i + 1 < argc)
+        {
+            const std::string method{argv[++i]};
+            if (method == "gaussian")
+                options.bloomMethod = Bloom::method::GAUSSIAN;
+            else if (method == "dual")
+                options.bloomMethod = Bloom::method::DUAL_FILTER;
+            else if (method == "compute")
+                options.bloomMethod = Bloom::method::COMPUTE;
+            else
+                std::cout << "Unknown bloom method: " << method << std::endl;
+        }
+        else
+            std::cout << "Unknown argument: " << arg << std::endl;
+    }
+
+    // Seed randomness, headless runs always use the same seed so they're comparable
+    std::srand(options.headlessFrames ? 0 : std::time(nullptr));
+    App app{options};
     return app.exec();
-}
\ No newline at end of file
+}
@@ -0,0 +1,289 @@
+#ifndef MESHPROCESSING_H
+#define MESHPROCESSING_H
+
+#include "components.h"
+#include <vector>
+#include <unordered_map>
+#include <utility>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <limits>
+#include <ostream>
+#include <iomanip>
+
+/**
+ * CPU side mesh processing done before anything is uploaded to the GPU.
+ * Turns triangle lists into welded index buffers and reorders them
+ * for the post-transform vertex cache and for vertex fetch locality.
+ */
+namespace meshproc {
+// Same layout as ModelLoader::container: vertices and triangle list indices
+typedef std::pair<std::vector<vertex>, std::vector<unsigned int>> container;
+
+// Post-transform cache size the optimizer orders triangles for (LRU)
+constexpr unsigned int OPTIMIZE_CACHE_SIZE = 32;
+// Post-transform cache size used when measuring ACMR (FIFO, like most hardware)
+constexpr unsigned int ANALYZE_CACHE_SIZE = 16;
+
+struct stats
+{
+    std::size_t verticesBefore{0}, verticesAfter{0};
+    std::size_t triangles{0};
+    // Average cache miss ratio, transformed vertices per triangle
+    float acmrBefore{0.f}, acmrAfter{0.f};
+};
+
+inline std::ostream& operator<<(std::ostream& os, const stats& s) {
+    const auto precision = os.precision();
+    os << s.verticesBefore << " -> " << s.verticesAfter << " vertices, " << s.triangles << " triangles, ACMR "
+        << std::fixed << std::setprecision(3) << s.acmrBefore << " -> " << s.acmrAfter << std::defaultfloat;
+    os.precision(precision);
+    return os;
+}
+
+struct vertexHash
+{
+    std::size_t operator()(const vertex& v) const {
+        // + 0.f turns -0.f into 0.f so equal vertices also hash equal
+        const float values[] = {
+            v.pos.x + 0.f, v.pos.y + 0.f, v.pos.z + 0.f,
+            v.normal.x + 0.f, v.normal.y + 0.f, v.normal.z + 0.f,
+            v.uv.x + 0.f, v.uv.y + 0.f
+        };
+        std::size_t h{14695981039346656037ull};
+        for (const auto& f : values) {
+            std::uint32_t bits;
+            std::memcpy(&bits, &f, sizeof(bits));
+            h = (h ^ bits) * 1099511628211ull;
+        }
+        return h;
+    }
+};
+
+struct vertexEqual
+{
+    bool operator()(const vertex& a, const vertex& b) const {
+        return a.pos == b.pos && a.normal == b.normal && a.uv == b.uv;
+    }
+};
+
+// Simulates a FIFO post-transform cache and returns transformed vertices per triangle.
+inline float acmr(const std::vector<unsigned int>& indices, std::size_t vertexCount, unsigned int cacheSize = ANALYZE_CACHE_SIZE) {
+    if (indices.size() < 3)
+        return 0.f;
+
+    // Cache entries are timestamps of when a vertex entered the cache
+    std::vector<std::size_t> cacheTime(vertexCount, 0);
+    std::size_t misses{0};
+    for (const auto& i : indices) {
+        if (cacheTime[i] == 0 || cacheSize <= misses - cacheTime[i]) {
+            ++misses;
+            cacheTime[i] = misses;
+        }
+    }
+    return static_cast<float>(misses) / (indices.size() / 3);
+}
+
+// Merges identical vertices of a triangle list into an indexed mesh.
+inline container weld(const std::vector<vertex>& vertices, const std::vector<unsigned int>& indices = {}) {
+    container result{};
+    const auto indexCount = indices.empty() ? vertices.size() : indices.size();
+    result.first.reserve(vertices.size());
+    result.second.reserve(indexCount);
+
+    std::unordered_map<vertex, unsigned int, vertexHash, vertexEqual> lookup{};
+    lookup.reserve(vertices.size());
+    for (std::size_t i{0}; i < indexCount; ++i) {
+        const auto& v = vertices[indices.empty() ? i : indices[i]];
+        auto [it, bInserted] = lookup.try_emplace(v, static_cast<unsigned int>(result.first.size()));
+        if (bInserted)
+            result.first.push_back(v);
+        result.second.push_back(it->second);
+    }
+
+    return result;
+}
+
+inline container weld(const container& mesh) { return weld(mesh.first, mesh.second); }
+
+/**
+ * Reorders triangles for the post-transform vertex cache.
+ * Implementation of Tom Forsyth's "Linear-Speed Vertex Cache Optimisation":
+ * vertices are scored by their cache position and how many triangles still need them,
+ * and the best scoring triangle touching the cache is emitted next.
+ */
+inline std::vector<unsigned int> optimizeVertexCache(const std::vector<unsigned int>& indices, std::size_t vertexCount, unsigned int cacheSize = OPTIMIZE_CACHE_SIZE) {
+    static constexpr float cacheDecayPower{1.5f}, lastTriScore{0.75f};
+    static constexpr float valenceBoostScale{2.f}, valenceBoostPower{0.5f};
+    constexpr auto none = std::numeric_limits<unsigned int>::max();
+
+    const auto triangleCount = static_cast<unsigned int>(indices.size() / 3);
+    if (triangleCount == 0 || cacheSize < 4)
+        return indices;
+
+    // Triangle adjacency per vertex. The first 'live[v]' entries are the triangles not yet emitted.
+    std::vector<unsigned int> live(vertexCount, 0), offsets(vertexCount + 1, 0), adjacency(triangleCount * 3);
+    for (unsigned int i{0}; i < triangleCount * 3; ++i)
+        ++live[indices[i]];
+    for (std::size_t v{0}; v < vertexCount; ++v)
+        offsets[v + 1] = offsets[v] + live[v];
+    {
+        std::vector<unsigned int> fill{offsets.begin(), offsets.end() - 1};
+        for (unsigned int i{0}; i < triangleCount * 3; ++i)
+            adjacency[fill[indices[i]]++] = i / 3;
+    }
+
+    std::vector<int> cachePos(vertexCount, -1);
+    std::vector<float> vertexScore(vertexCount, 0.f), triangleScore(triangleCount, 0.f);
+    std::vector<bool> emitted(triangleCount, false);
+
+    auto scoreVertex = [&](unsigned int v) {
+        if (live[v] == 0)
+            return -1.f;
+
+        float score{0.f};
+        const auto p = cachePos[v];
+        if (0 <= p) {
+            // The last triangle's vertices get a fixed score so it's not reused right away
+            if (p < 3)
+                score = lastTriScore;
+            else
+                score = std::pow(1.f - (p - 3) * (1.f / (cacheSize - 3)), cacheDecayPower);
+        }
+        // Boost vertices with few triangles left so they're finished off and not left stranded
+        return score + valenceBoostScale * std::pow(static_cast<float>(live[v]), -valenceBoostPower);
+    };
+
+    for (std::size_t v{0}; v < vertexCount; ++v)
+        vertexScore[v] = scoreVertex(static_cast<unsigned int>(v));
+
+    unsigned int bestTriangle{0};
+    for (unsigned int t{0}; t < triangleCount; ++t) {
+        triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+        if (triangleScore[bestTriangle] < triangleScore[t])
+            bestTriangle = t;
+    }
+
+    std::vector<unsigned int> result{}, cache{}, newCache{};
+    result.reserve(indices.size());
+    cache.reserve(cacheSize + 3);
+    newCache.reserve(cacheSize + 3);
+    unsigned int scanPos{0};
+
+    while (result.size() < indices.size()) {
+        // Nothing in the cache is adjacent to a live triangle, so start anywhere new
+        if (bestTriangle == none) {
+            while (emitted[scanPos])
+                ++scanPos;
+            bestTriangle = scanPos;
+        }
+
+        const auto t = bestTriangle;
+        emitted[t] = true;
+        newCache.clear();
+        for (unsigned int k{0}; k < 3; ++k) {
+            const auto v = indices[t * 3 + k];
+            result.push_back(v);
+            newCache.push_back(v);
+
+            // Remove the triangle from the vertex' live list
+            auto begin = adjacency.begin() + offsets[v];
+            auto it = std::find(begin, begin + live[v], t);
+            std::iter_swap(it, begin + live[v] - 1);
+            --live[v];
+        }
+
+        for (const auto& v : cache)
+            if (std::find(newCache.begin(), newCache.begin() + 3, v) == newCache.begin() + 3)
+                newCache.push_back(v);
+
+        // Vertices pushed out of the cache lose their cache position bonus, so triangles
+        // sharing them with cached vertices aren't overrated later on
+        for (std::size_t i{cacheSize}; i < newCache.size(); ++i) {
+            cachePos[newCache[i]] = -1;
+            vertexScore[newCache[i]] = scoreVertex(newCache[i]);
+        }
+        if (cacheSize < newCache.size())
+            newCache.resize(cacheSize);
+        for (std::size_t i{0}; i < newCache.size(); ++i)
+            cachePos[newCache[i]] = static_cast<int>(i);
+
+        // Rescore everything in the cache and pick the best triangle using it
+        bestTriangle = none;
+        float bestScore{-1.f};
+        for (const auto& v : newCache)
+            vertexScore[v] = scoreVertex(v);
+        for (const auto& v : newCache) {
+            for (unsigned int a{offsets[v]}; a < offsets[v] + live[v]; ++a) {
+                const auto tri = adjacency[a];
+                auto& score = triangleScore[tri];
+                score = vertexScore[indices[tri * 3]] + vertexScore[indices[tri * 3 + 1]] + vertexScore[indices[tri * 3 + 2]];
+                if (bestScore < score) {
+                    bestScore = score;
+                    bestTriangle = tri;
+                }
+            }
+        }
+
+        std::swap(cache, newCache);
+    }
+
+    return result;
+}
+
+// Reorders vertices in the order they're first used, so vertex fetches walk the buffer linearly.
+inline void optimizeVertexFetch(container& mesh) {
+    constexpr auto none = std::numeric_limits<unsigned int>::max();
+    std::vector<unsigned int> remap(mesh.first.size(), none);
+    std::vector<vertex> vertices{};
+    vertices.reserve(mesh.first.size());
+
+    for (auto& i : mesh.second) {
+        if (remap[i] == none) {
+            remap[i] = static_cast<unsigned int>(vertices.size());
+            vertices.push_back(mesh.first[i]);
+        }
+        i = remap[i];
+    }
+
+    // Vertices not referenced by any triangle are dropped
+    mesh.first = std::move(vertices);
+}
+
+/**
+ * Full pipeline: welds duplicate vertices, optimizes triangle order for the
+ * vertex cache and vertex order for fetching.
+ * Pass an empty index list for unindexed triangle lists (like shapes::cubeSphere).
+ */
+inline stats optimize(container& mesh) {
+    stats s{};
+    s.verticesBefore = mesh.first.size();
+    if (mesh.second.empty()) {
+        // Unindexed, so every vertex is transformed once
+        s.acmrBefore = mesh.first.size() < 3 ? 0.f : 3.f;
+    } else {
+        s.acmrBefore = acmr(mesh.second, mesh.first.size());
+    }
+
+    mesh = weld(mesh);
+    mesh.second = optimizeVertexCache(mesh.second, mesh.first.size());
+    optimizeVertexFetch(mesh);
+
+    s.verticesAfter = mesh.first.size();
+    s.triangles = mesh.second.size() / 3;
+    s.acmrAfter = acmr(mesh.second, mesh.first.size());
+    return s;
+}
+
+inline container optimized(std::vector<vertex> vertices, stats* s = nullptr) {
+    container mesh{std::move(vertices), {}};
+    const auto result = optimize(mesh);
+    if (s != nullptr)
+        *s = result;
+    return mesh;
+}
+}
+
+#endif // MESHPROCESSING_H
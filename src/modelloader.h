@@ -3,6 +3,9 @@
 
 #include "json.hpp" // https://github.com/nlohmann/json
 #include "components.h"
+#include "meshprocessing.h"
+#include "vertexformat.h"
+#include "geometrybuffer.h"
 #include <fstream>
 #include <iostream>
 #include <functional>
@@ -22,6 +25,9 @@ private:
 public:    
     typedef std::pair<std::vector<vertex>, std::vector<unsigned>> container;
 
+    // Vertex layout models are uploaded with
+    vertexformat::preset vertexFormat{vertexformat::preset::FLOAT};
+
 private:
     template <typename T>
     static void iterateIndex(std::vector<std::vector<std::byte>> &cachedBuffers, nlohmann::basic_json<>::value_type &bufferView, unsigned int pointCount, container &result)
@@ -65,37 +71,10 @@ private:
     
     auto& initObj(const std::string& file) {
         auto obj = load(file);
-        auto& mesh = mLoadedModels.emplace_back(file, component::mesh{}).second;
-        // Do OpenGL stuff
-
-        glGenVertexArrays(1, &mesh.VAO);
-        glGenBuffers(1, &mesh.VBO);
-        glGenBuffers(1, &mesh.IBO);
-        // bind the Vertex Array Object first, then bind and set vertex buffer(s), and then configure vertex attributes(s).
-        glBindVertexArray(mesh.VAO);
-
-        glBindBuffer(GL_ARRAY_BUFFER, mesh.VBO);
-        glBufferData(GL_ARRAY_BUFFER, obj.first.size() * sizeof(vertex), obj.first.data(), GL_STATIC_DRAW);
-
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.IBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, obj.second.size() * sizeof(unsigned int), obj.second.data(), GL_STATIC_DRAW);
-        // GLint bufferSize;
-        // glGetBufferParameteriv(GL_ELEMENT_ARRAY_BUFFER, GL_BUFFER_SIZE, &bufferSize);
-        // std::cout << "buffer size: " << bufferSize << std::endl;
-
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), (void *)0);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), (void *)(3 * sizeof(float)));
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(vertex), (void *)(6 * sizeof(float)));
-        glEnableVertexAttribArray(0);
-        glEnableVertexAttribArray(1);
-        glEnableVertexAttribArray(2);
-
-        mesh.vertexCount = static_cast<unsigned int>(obj.first.size());
-        mesh.bIndices = true;
-        // std::tuple_size to get length of array. Surprisingly that it doesn't already exist in std::array
-        // https://stackoverflow.com/questions/21936507/why-isnt-stdarraysize-static
-        mesh.indexCount = static_cast<unsigned int>(obj.second.size());
-
+        std::cout << "Mesh " << file << ": " << meshproc::optimize(obj) << std::endl;
+        const auto layout = vertexformat::select(vertexFormat, obj.first);
+        std::cout << "Vertex format " << file << ": " << vertexformat::validate(obj.first, layout) << std::endl;
+        auto& mesh = mLoadedModels.emplace_back(file, GeometryBuffer::get().add(obj.first, obj.second, layout)).second;
         return mesh;
     }
 
@@ -417,20 +396,11 @@ public:
         }
     }
 
-    /**
-     * Don't really need to ever call this function as by this point all
-     * VAOs should already be deleted and the data stored here should be
-     * garbage values.
-     */
+    // Releases the models' geometry. Not needed if GeometryBuffer::clear() is called anyway.
     void deInitModels() {
-        for (auto& m : mLoadedModels) {
-            auto& mesh = m.second;
-            if (mesh.bIndices)
-                glDeleteBuffers(1, &mesh.IBO);
-
-            glDeleteBuffers(1, &mesh.VBO);
-            glDeleteVertexArrays(1, &mesh.VAO);
-        }
+        for (auto& m : mLoadedModels)
+            GeometryBuffer::get().remove(m.second);
+        mLoadedModels.clear();
     }
 };
 
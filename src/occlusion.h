@@ -0,0 +1,321 @@
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <array>
+#include <atomic>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+#include <map>
+#include <utility>
+#include "threadpool.h"
+#include "trace.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && 2 <= _M_IX86_FP)
+#include <emmintrin.h>
+#define OCCLUSION_SSE
+#endif
+
+/**
+ * Low resolution depth buffer rasterized on the CPU, for skipping objects hidden
+ * behind large occluders before their draws are submitted.
+ *
+ * Occluders are drawn with a coarse mesh that must lie inside the object it stands in
+ * for (the corners of a sphere mesh lie on the sphere, so the mesh is inside it).
+ * Along the outline only pixels fully covered by the mesh are written, and every pixel
+ * gets the farthest depth of its triangle within it, which keeps the buffer conservative:
+ * it never hides something visible.
+ * The buffer is split into tiles rasterized in parallel, four pixels at a time.
+ * Each tile also builds its part of a max depth pyramid (hierarchical Z), which
+ * visible() tests bounding spheres against with a handful of reads.
+ *
+ * Depth is window depth in [0, 1], cleared to 1 (far).
+ */
+class OcclusionBuffer
+{
+public:
+    static constexpr int WIDTH = 256;
+    static constexpr int HEIGHT = 192;
+    static constexpr int TILE_SIZE = 32;
+    static constexpr int TILES_X = WIDTH / TILE_SIZE;
+    static constexpr int TILES_Y = HEIGHT / TILE_SIZE;
+    // Pyramid levels, halving down to one texel per tile
+    static constexpr int LEVELS = 6;
+    static_assert(WIDTH % TILE_SIZE == 0 && HEIGHT % TILE_SIZE == 0 && TILE_SIZE % 4 == 0);
+    static_assert(TILE_SIZE >> (LEVELS - 1) == 1);
+
+private:
+    struct triangle
+    {
+        // Edge functions a * x + b * y + c at pixel (x, y), all positive if the pixel is drawn
+        std::array<float, 3> a, b, c;
+        // Depth plane, giving the farthest depth within pixel (x, y)
+        float za, zb, zc;
+        // Inclusive pixel bounds
+        int minX, minY, maxX, maxY;
+    };
+
+    std::vector<glm::vec3> mMeshPositions;
+    std::vector<unsigned int> mMeshIndices;
+    // Triangle sharing edge i (indices i and i + 1) of every triangle, or -1
+    std::vector<std::array<int, 3>> mNeighbours;
+    std::vector<triangle> mTriangles;
+    // Level 0 is the depth buffer itself, every level is row major
+    std::array<std::vector<float>, LEVELS> mLevels;
+    // Per occluder scratch space: window coordinates (w < 0 behind the near plane) and facing of every triangle
+    std::vector<glm::vec4> mWindow;
+    std::vector<float> mAreas;
+
+    glm::mat4 mView{1.f}, mProj{1.f}, mViewProj{1.f};
+    float mNear{0.f};
+    unsigned int mOccluders{0};
+    bool bReady{false};
+    mutable std::atomic<unsigned int> mTested{0}, mOccluded{0};
+
+    static constexpr int levelWidth(int level) { return WIDTH >> level; }
+
+    // Window depth of a view space depth (negative in front of the camera)
+    float windowDepth(float viewZ) const {
+        const auto clip = mProj * glm::vec4{0.f, 0.f, viewZ, 1.f};
+        return clip.z / clip.w * 0.5f + 0.5f;
+    }
+
+    // v holds window coordinates, silhouette marks the edges (v[i], v[i + 1]) on the occluder's outline
+    void setupTriangle(const std::array<glm::vec3, 3>& v, float area, const std::array<bool, 3>& silhouette) {
+        triangle t{};
+        t.minX = std::max(static_cast<int>(std::floor(std::min({v[0].x, v[1].x, v[2].x}))), 0);
+        t.minY = std::max(static_cast<int>(std::floor(std::min({v[0].y, v[1].y, v[2].y}))), 0);
+        t.maxX = std::min(static_cast<int>(std::ceil(std::max({v[0].x, v[1].x, v[2].x}))) - 1, WIDTH - 1);
+        t.maxY = std::min(static_cast<int>(std::ceil(std::max({v[0].y, v[1].y, v[2].y}))) - 1, HEIGHT - 1);
+        if (t.maxX < t.minX || t.maxY < t.minY)
+            return;
+
+        for (int i{0}; i < 3; ++i) {
+            const auto& p = v[i];
+            const auto& q = v[(i + 1) % 3];
+            t.a[i] = p.y - q.y;
+            t.b[i] = q.x - p.x;
+            // Evaluated at the pixel center. Outline edges subtract the most the edge function drops within
+            // half a pixel, so only fully covered pixels pass, while inner edges leave no cracks.
+            t.c[i] = -(t.a[i] * p.x + t.b[i] * p.y) + 0.5f * (t.a[i] + t.b[i]);
+            if (silhouette[i])
+                t.c[i] -= 0.5f * (std::abs(t.a[i]) + std::abs(t.b[i]));
+        }
+
+        const auto dz1 = v[1].z - v[0].z, dz2 = v[2].z - v[0].z;
+        t.za = (dz1 * (v[2].y - v[0].y) - dz2 * (v[1].y - v[0].y)) / area;
+        t.zb = (dz2 * (v[1].x - v[0].x) - dz1 * (v[2].x - v[0].x)) / area;
+        // Same for depth, plus the most it grows within half a pixel
+        t.zc = v[0].z - t.za * v[0].x - t.zb * v[0].y + 0.5f * (t.za + t.zb) + 0.5f * (std::abs(t.za) + std::abs(t.zb));
+        mTriangles.push_back(t);
+    }
+
+    void rasterizeTile(int tile) {
+        const int tileX{tile % TILES_X * TILE_SIZE}, tileY{tile / TILES_X * TILE_SIZE};
+        auto& depth = mLevels[0];
+        for (int y{tileY}; y < tileY + TILE_SIZE; ++y)
+            std::fill_n(depth.begin() + y * WIDTH + tileX, TILE_SIZE, 1.f);
+
+        for (const auto& t : mTriangles) {
+            // Whole groups of four pixels, which stay inside the tile as it's a multiple of four wide
+            const int minX{std::max(t.minX, tileX) & ~3}, maxX{std::min(t.maxX, tileX + TILE_SIZE - 1)};
+            const int minY{std::max(t.minY, tileY)}, maxY{std::min(t.maxY, tileY + TILE_SIZE - 1)};
+            if (maxX < minX || maxY < minY)
+                continue;
+
+            for (int y{minY}; y <= maxY; ++y) {
+                float* row = depth.data() + y * WIDTH;
+                const auto fy = static_cast<float>(y);
+                const float e0{t.b[0] * fy + t.c[0]}, e1{t.b[1] * fy + t.c[1]}, e2{t.b[2] * fy + t.c[2]};
+                const float z{t.zb * fy + t.zc};
+#ifdef OCCLUSION_SSE
+                const auto a0 = _mm_set1_ps(t.a[0]), a1 = _mm_set1_ps(t.a[1]), a2 = _mm_set1_ps(t.a[2]), az = _mm_set1_ps(t.za);
+                const auto zero = _mm_setzero_ps();
+                for (int x{minX}; x <= maxX; x += 4) {
+                    const auto fx = _mm_add_ps(_mm_set1_ps(static_cast<float>(x)), _mm_setr_ps(0.f, 1.f, 2.f, 3.f));
+                    const auto inside = _mm_and_ps(_mm_and_ps(
+                        _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a0, fx), _mm_set1_ps(e0)), zero),
+                        _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a1, fx), _mm_set1_ps(e1)), zero)),
+                        _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a2, fx), _mm_set1_ps(e2)), zero));
+                    const auto old = _mm_loadu_ps(row + x);
+                    const auto nearest = _mm_min_ps(old, _mm_add_ps(_mm_mul_ps(az, fx), _mm_set1_ps(z)));
+                    _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, old)));
+                }
+#else
+                for (int x{minX}; x < ((maxX + 4) & ~3); ++x) {
+                    const auto fx = static_cast<float>(x);
+                    const bool bInside = 0.f <= t.a[0] * fx + e0 && 0.f <= t.a[1] * fx + e1 && 0.f <= t.a[2] * fx + e2;
+                    row[x] = bInside ? std::min(row[x], t.za * fx + z) : row[x];
+                }
+#endif
+            }
+        }
+
+        // This tile's part of the pyramid
+        for (int level{1}; level < LEVELS; ++level) {
+            const auto& src = mLevels[level - 1];
+            auto& dst = mLevels[level];
+            const int size{TILE_SIZE >> level}, x0{tileX >> level}, y0{tileY >> level};
+            const int srcWidth{levelWidth(level - 1)}, dstWidth{levelWidth(level)};
+            for (int y{y0}; y < y0 + size; ++y)
+                for (int x{x0}; x < x0 + size; ++x) {
+                    const auto* s = src.data() + 2 * y * srcWidth + 2 * x;
+                    dst[y * dstWidth + x] = std::max(std::max(s[0], s[1]), std::max(s[srcWidth], s[srcWidth + 1]));
+                }
+        }
+    }
+
+public:
+    OcclusionBuffer() {
+        for (int level{0}; level < LEVELS; ++level)
+            mLevels[level].assign(static_cast<std::size_t>(WIDTH >> level) * (HEIGHT >> level), 1.f);
+    }
+
+    OcclusionBuffer(const OcclusionBuffer&) = delete;
+    OcclusionBuffer(OcclusionBuffer&&) = delete;
+    void operator=(const OcclusionBuffer&) = delete;
+    void operator=(OcclusionBuffer&&) = delete;
+
+    /**
+     * Mesh drawn for every occluder, counter clockwise triangles in object space.
+     * Edges are matched by position, so split vertices don't break the outline detection.
+     */
+    void setOccluderMesh(std::vector<glm::vec3> positions, std::vector<unsigned int> indices) {
+        mMeshPositions = std::move(positions);
+        mMeshIndices = std::move(indices);
+
+        std::map<std::array<float, 3>, unsigned int> welded;
+        std::vector<unsigned int> ids(mMeshPositions.size());
+        for (std::size_t i{0}; i < mMeshPositions.size(); ++i)
+            ids[i] = welded.emplace(std::array<float, 3>{mMeshPositions[i].x, mMeshPositions[i].y, mMeshPositions[i].z}, static_cast<unsigned int>(welded.size())).first->second;
+
+        const auto triangleCount = mMeshIndices.size() / 3;
+        std::map<std::pair<unsigned int, unsigned int>, int> edges;
+        for (std::size_t i{0}; i < triangleCount; ++i)
+            for (int e{0}; e < 3; ++e)
+                edges[{ids[mMeshIndices[3 * i + e]], ids[mMeshIndices[3 * i + (e + 1) % 3]]}] = static_cast<int>(i);
+
+        // The neighbour walks the shared edge the other way
+        mNeighbours.assign(triangleCount, {-1, -1, -1});
+        for (std::size_t i{0}; i < triangleCount; ++i)
+            for (int e{0}; e < 3; ++e)
+                if (auto it = edges.find({ids[mMeshIndices[3 * i + (e + 1) % 3]], ids[mMeshIndices[3 * i + e]]}); it != edges.end())
+                    mNeighbours[i][e] = it->second;
+    }
+
+    // Starts a new frame seen through view and proj
+    void begin(const glm::mat4& view, const glm::mat4& proj) {
+        mView = view;
+        mProj = proj;
+        mViewProj = proj * view;
+        // Distance to the near plane, from the projection's depth terms
+        mNear = proj[3][2] / (proj[2][2] - 1.f);
+        mTriangles.clear();
+        mOccluders = 0;
+        bReady = false;
+        mTested = 0;
+        mOccluded = 0;
+    }
+
+    void addOccluder(const glm::mat4& model) {
+        const auto mvp = mViewProj * model;
+        mWindow.resize(mMeshPositions.size());
+        for (std::size_t i{0}; i < mMeshPositions.size(); ++i) {
+            const auto c = mvp * glm::vec4{mMeshPositions[i], 1.f};
+            mWindow[i] = (c.w <= mNear) ? glm::vec4{-1.f}
+                : glm::vec4{(c.x / c.w * 0.5f + 0.5f) * WIDTH, (c.y / c.w * 0.5f + 0.5f) * HEIGHT, c.z / c.w * 0.5f + 0.5f, 1.f};
+        }
+
+        // Counter clockwise triangles face the camera, the back faces are hidden behind them.
+        // Triangles crossing the near plane are left out, which only hides less.
+        const auto triangleCount = mMeshIndices.size() / 3;
+        mAreas.resize(triangleCount);
+        for (std::size_t i{0}; i < triangleCount; ++i) {
+            const auto& v0 = mWindow[mMeshIndices[3 * i]];
+            const auto& v1 = mWindow[mMeshIndices[3 * i + 1]];
+            const auto& v2 = mWindow[mMeshIndices[3 * i + 2]];
+            mAreas[i] = (v0.w < 0.f || v1.w < 0.f || v2.w < 0.f) ? 0.f
+                : (v1.x - v0.x) * (v2.y - v0.y) - (v2.x - v0.x) * (v1.y - v0.y);
+        }
+
+        for (std::size_t i{0}; i < triangleCount; ++i) {
+            if (mAreas[i] <= std::numeric_limits<float>::epsilon())
+                continue;
+
+            std::array<glm::vec3, 3> v;
+            std::array<bool, 3> silhouette;
+            for (int e{0}; e < 3; ++e) {
+                v[e] = glm::vec3{mWindow[mMeshIndices[3 * i + e]]};
+                const auto n = mNeighbours[i][e];
+                silhouette[e] = n < 0 || mAreas[n] <= std::numeric_limits<float>::epsilon();
+            }
+            setupTriangle(v, mAreas[i], silhouette);
+        }
+        ++mOccluders;
+    }
+
+    // Rasterizes the occluders added since begin(). visible() may be called from any thread afterwards.
+    void rasterize() {
+        ThreadPool::get().parallelFor(TILES_X * TILES_Y, 1, [&](std::size_t begin, std::size_t end) {
+            TraceZone zone{"OcclusionBuffer::rasterize"};
+            for (auto tile{begin}; tile < end; ++tile)
+                rasterizeTile(static_cast<int>(tile));
+        });
+        bReady = true;
+    }
+
+    // Conservative: false only if the sphere is entirely behind the occluders
+    bool visible(const glm::vec3& center, float radius) const {
+        if (!bReady || mTriangles.empty())
+            return true;
+        ++mTested;
+
+        const glm::vec3 c{mView * glm::vec4{center, 1.f}};
+        const auto nearestZ = c.z + radius;
+        if (-mNear <= nearestZ)
+            return true;
+
+        // Screen bounds of the sphere's view space box, which encloses its projection
+        glm::vec2 lower{std::numeric_limits<float>::max()}, upper{std::numeric_limits<float>::lowest()};
+        for (int i{0}; i < 8; ++i) {
+            const glm::vec3 corner{c.x + ((i & 1) ? radius : -radius), c.y + ((i & 2) ? radius : -radius), c.z + ((i & 4) ? radius : -radius)};
+            const auto clip = mProj * glm::vec4{corner, 1.f};
+            const glm::vec2 screen{clip.x / clip.w * 0.5f + 0.5f, clip.y / clip.w * 0.5f + 0.5f};
+            lower = glm::min(lower, screen);
+            upper = glm::max(upper, screen);
+        }
+        const int minX{std::max(static_cast<int>(std::floor(lower.x * WIDTH)), 0)}, maxX{std::min(static_cast<int>(std::floor(upper.x * WIDTH)), WIDTH - 1)};
+        const int minY{std::max(static_cast<int>(std::floor(lower.y * HEIGHT)), 0)}, maxY{std::min(static_cast<int>(std::floor(upper.y * HEIGHT)), HEIGHT - 1)};
+        // Off screen, which is for frustum culling to decide
+        if (maxX < minX || maxY < minY)
+            return true;
+
+        // Coarsest needed level where the bounds span at most 4x4 texels
+        int level{0};
+        while (level + 1 < LEVELS && (3 < (maxX >> level) - (minX >> level) || 3 < (maxY >> level) - (minY >> level)))
+            ++level;
+
+        const auto depth = windowDepth(nearestZ);
+        const auto& texels = mLevels[level];
+        const auto width = levelWidth(level);
+        for (int y{minY >> level}; y <= (maxY >> level); ++y)
+            for (int x{minX >> level}; x <= (maxX >> level); ++x)
+                if (depth <= texels[y * width + x])
+                    return true;
+
+        ++mOccluded;
+        return false;
+    }
+
+    // Depth buffer, WIDTH * HEIGHT texels from the bottom left
+    const std::vector<float>& depth() const { return mLevels[0]; }
+    unsigned int occluders() const { return mOccluders; }
+    std::size_t triangles() const { return mTriangles.size(); }
+    // visible() calls since begin() that reached the depth test, and how many of them were hidden
+    unsigned int tested() const { return mTested; }
+    unsigned int occluded() const { return mOccluded; }
+};
+
+#endif // OCCLUSION_H
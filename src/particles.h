@@ -3,28 +3,99 @@
 
 #include "components.h"
 #include "shader.h"
+#include "uploadring.h"
+#include "glstate.h"
+#include "gpumemory.h"
+#include "vertexformat.h"
 #include <vector>
+#include <algorithm>
+#include <cstring>
 #include <glad/glad.h>
 
+/**
+ * Trails of the particles, stored as one ring of trailSize rows with a position per particle
+ * each. All particles share the head, the row holding the newest positions, so a frame only
+ * writes and uploads that row into a GPU buffer holding the whole ring. particle.vert finds
+ * the row of a trail sample from its age and head.
+ * With GPU trails the CPU keeps no history and only uploads the current positions,
+ * which trail.comp appends to the ring. Trail spheres then aren't occlusion culled,
+ * as that would take a CPU test per sample.
+ */
 template <std::size_t pCount, std::size_t trailSize = 10>
 class Particles {
 private:
-    unsigned int b;
     Shader particleShader;
     typedef typename glm::vec4 pPosT;
+    // Words of hidden flags per particle, one bit per trail sample
+    static constexpr std::size_t maskWords = (trailSize + 31) / 32;
+    // Must match the bindings of TrailData in particle.vert and Bodies in trail.comp
+    static constexpr unsigned int TRAIL_BINDING = 11;
+    static constexpr unsigned int BODY_BINDING = 12;
+
+    Shader trailShader;
+    bool bGpuTrails;
+    // Sample in row s of particle i at s * pCount + i, same layout as TrailData (CPU trails only)
+    std::vector<glm::vec3> mTrail;
+    // Current positions for trail.comp, w is 1 where the trail starts over (GPU trails only)
+    std::vector<pPosT> mBodies;
+    // updatePos() ran since the positions were last appended on the GPU
+    bool bAppend{false};
+    // Every trail starts over at its particle on the next updatePos()
+    bool bRestart{true};
+    unsigned int mTrailBuffer{0};
+    // Row of the newest samples
+    std::size_t mHead{trailSize - 1};
+    // Particles given an index so far
+    std::size_t mCount{0};
+    // Rows changed since the last upload
+    std::size_t mDirtyFirst{0}, mDirtyCount{0};
+
+    // Appends the positions written by updatePos() to the ring, one invocation per particle
+    void append(UploadRing& ring) {
+        if (!bAppend || mCount == 0)
+            return;
+
+        auto block = ring.allocate(mCount * sizeof(pPosT), GL_SHADER_STORAGE_BUFFER);
+        if (!block)
+            return;
+        std::memcpy(block.ptr, mBodies.data(), block.size);
+        for (std::size_t i{0}; i < mCount; ++i)
+            mBodies[i].w = 0.f;
+        bAppend = false;
+
+        ring.bindRange(GL_SHADER_STORAGE_BUFFER, BODY_BINDING, block);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, TRAIL_BINDING, mTrailBuffer);
+        const auto s = trailShader.get();
+        GLState::get().useProgram(s);
+        glUniform1i(glGetUniformLocation(s, "head"), static_cast<GLint>(mHead));
+        glUniform1ui(glGetUniformLocation(s, "count"), static_cast<GLuint>(mCount));
+        glDispatchCompute((static_cast<GLuint>(mCount) + 63) / 64, 1, 1);
+        // Read by particle.vert, and written by glCopyNamedBufferSubData after switching to CPU trails
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+    }
 
 public:
-    Particles()
+    // Number of instances drawn by render()
+    static constexpr std::size_t instanceCount = pCount * trailSize;
+
+    // meshFormat is the vertex format preset of the meshes drawn by render()
+    Particles(vertexformat::preset meshFormat, bool gpuTrails = false)
         : particleShader{"src/shaders/particle.vert", "src/shaders/particle.frag", {
+            vertexformat::shaderVar(meshFormat),
+            {"pcount", std::to_string(pCount)},
+            {"tlength", std::to_string(trailSize)},
+            {"maskwords", std::to_string(maskWords)}
+        }},
+        trailShader{Shader::compute("src/shaders/trail.comp", {
             {"pcount", std::to_string(pCount)},
             {"tlength", std::to_string(trailSize)}
-        }}
+        })},
+        // The other mode, so setGpuTrails() sets up this one
+        bGpuTrails{!gpuTrails}
     {
-        glGenBuffers(1, &b);
-        glBindBuffer(GL_SHADER_STORAGE_BUFFER, b);
-        glBufferData(GL_SHADER_STORAGE_BUFFER, pCount * (trailSize + 2) * sizeof(pPosT), nullptr, GL_STATIC_DRAW);
-        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, b);
-        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        setGpuTrails(gpuTrails);
+        glCreateBuffers(1, &mTrailBuffer);
+        GpuMemory::get().bufferStorage("Particles", mTrailBuffer, instanceCount * sizeof(pPosT), nullptr, 0);
     }
 
     // Prevent move and copy functionality
@@ -33,70 +104,131 @@ public:
     void operator=(const Particles&) = delete;
     void operator=(Particles&&) = delete;
 
+    // Switching restarts the trails, as only the CPU mode keeps their history
+    void setGpuTrails(bool gpuTrails) {
+        if (gpuTrails == bGpuTrails)
+            return;
+
+        bGpuTrails = gpuTrails;
+        bRestart = true;
+        mDirtyCount = 0;
+        bAppend = false;
+        mTrail = bGpuTrails ? std::vector<glm::vec3>{} : std::vector<glm::vec3>(pCount * trailSize);
+        mBodies = bGpuTrails ? std::vector<pPosT>(pCount) : std::vector<pPosT>{};
+    }
+
+    bool gpuTrails() const { return bGpuTrails; }
+
+    // Moves the head one row on and writes the current positions into it
     template <typename T>
-    static void updatePos(T&& view) {
+    void updatePos(T&& view) {
+        mHead = (mHead + 1) % trailSize;
+        if (bGpuTrails) {
+            bAppend = true;
+        } else {
+            // Rows change in ring order, so the changed ones stay a single range
+            if (mDirtyCount == 0)
+                mDirtyFirst = mHead;
+            mDirtyCount = std::min(mDirtyCount + 1, trailSize);
+        }
+
         for (auto ent{view.begin()}; ent != view.end(); ++ent) {
-            auto& [t, p] = view.get<component::trans, component::particle>(*ent);
-
-            p.pos.push(t.pos);
-            // Ensure there are 10 items in the queue
-            if (p.pos.size() != trailSize + 1)
-                for (std::size_t i{trailSize - p.pos.size()}; 0 < i; --i)
-                    p.pos.push(t.pos);
-            else
-            // Pop back
-                p.pos.pop();
-            
+            auto [t, p] = view.template get<component::trans, component::particle>(*ent);
+
+            bool bNew{bRestart};
+            if (p.index == component::particle::NONE) {
+                if (pCount <= mCount)
+                    continue;
+                p.index = static_cast<unsigned int>(mCount++);
+                bNew = true;
+            }
+
+            // A new trail starts with every sample at the particle
+            if (bGpuTrails) {
+                mBodies[p.index] = pPosT{t.pos, bNew ? 1.f : 0.f};
+            } else {
+                if (bNew) {
+                    for (std::size_t row{0}; row < trailSize; ++row)
+                        mTrail[row * pCount + p.index] = t.pos;
+                    mDirtyFirst = 0;
+                    mDirtyCount = trailSize;
+                }
+                mTrail[mHead * pCount + p.index] = t.pos;
+            }
             p.scale = t.scale;
         }
+        bRestart = false;
     }
 
-    template <typename T>
-    void updateShaderData(T&& view) {
-        glBindBuffer(GL_SHADER_STORAGE_BUFFER, b);
-        std::array<pPosT, trailSize> positions{};
-        std::array<pPosT, pCount> scales{};
-        std::array<pPosT, pCount> colors{};
-        GLintptr bufferOffset{0};
-        constexpr auto blockSize = sizeof(positions);
-        unsigned int i{0};
-
-        for (auto ent{view.begin()}; ent != view.end() && i < pCount; ++ent, ++i) {
-            const auto& p = view.get<component::particle>(*ent);
-
-            std::transform(p.pos.begin(), p.pos.end(), positions.begin(), [](const glm::vec3& p){
-                return glm::vec4{p, 0.0};
-            });
-            glBufferSubData(GL_SHADER_STORAGE_BUFFER, bufferOffset, blockSize, positions.data());
-            bufferOffset += blockSize;
+    /**
+     * Uploads the changed trail rows, or appends the positions with trail.comp, and writes
+     * scales, colors and hidden flags straight into this frame's region of the upload ring,
+     * in the layout of ParticleData in particle.vert, binding it to binding 2.
+     * With CPU trails, trail spheres where visible(pos, radius) is false are hidden.
+     */
+    template <typename T, typename V>
+    void updateShaderData(T&& view, UploadRing& ring, V&& visible) {
+        if (bGpuTrails)
+            append(ring);
+
+        // The changed rows wrap around at most once
+        while (0 < mDirtyCount) {
+            const auto rows = std::min(mDirtyCount, trailSize - mDirtyFirst);
+            auto rowBlock = ring.allocate(rows * pCount * sizeof(pPosT), GL_SHADER_STORAGE_BUFFER);
+            // Stays changed, to be uploaded next frame
+            if (!rowBlock)
+                break;
+
+            const auto first = mTrail.begin() + mDirtyFirst * pCount;
+            std::transform(first, first + rows * pCount, reinterpret_cast<pPosT*>(rowBlock.ptr), [](const glm::vec3& p) { return pPosT{p, 0.f}; });
+            glCopyNamedBufferSubData(ring.get(), mTrailBuffer, rowBlock.offset, mDirtyFirst * pCount * sizeof(pPosT), rowBlock.size);
+            mDirtyFirst = (mDirtyFirst + rows) % trailSize;
+            mDirtyCount -= rows;
         }
 
-        auto it = scales.begin();
-        auto cit = colors.begin();
-        unsigned particleCount{0};
+        auto block = ring.allocate(pCount * (2 * sizeof(pPosT) + maskWords * sizeof(GLuint)), GL_SHADER_STORAGE_BUFFER);
+        if (!block)
+            return;
+
+        auto scales = reinterpret_cast<pPosT*>(block.ptr);
+        auto colors = scales + pCount;
+        auto hidden = reinterpret_cast<GLuint*>(colors + pCount);
+        // The ring memory still holds older frames, so hide unused particles
+        std::fill(scales, scales + pCount, pPosT{0.f});
+        std::fill(hidden, hidden + pCount * maskWords, 0u);
+
         view.each([&](auto ent, const component::particle& p, const component::mat& m){
-            *it = glm::vec4{p.scale, 0.f};
-            *cit = glm::vec4{m.color, 1.f};
-            ++it;
-            ++cit;
+            if (p.index == component::particle::NONE)
+                return;
+
+            // Trail spheres are drawn at 0.2 times the scale, see particle.vert
+            const auto radius = std::max({p.scale.x, p.scale.y, p.scale.z}) * 0.2f;
+            // Trails waiting for a restart are left visible, mTrail may be stale
+            if (!bGpuTrails && !bRestart) {
+                for (std::size_t row{0}; row < trailSize; ++row)
+                    if (!visible(mTrail[row * pCount + p.index], radius))
+                        hidden[p.index * maskWords + row / 32] |= 1u << (row % 32);
+            }
+            scales[p.index] = pPosT{p.scale, 0.f};
+            colors[p.index] = pPosT{m.color, 1.f};
         });
-        glBufferSubData(GL_SHADER_STORAGE_BUFFER, bufferOffset, sizeof(scales), scales.data());
-        bufferOffset += sizeof(scales);
-        glBufferSubData(GL_SHADER_STORAGE_BUFFER, bufferOffset, sizeof(colors), colors.data());
-        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+        ring.bindRange(GL_SHADER_STORAGE_BUFFER, 2, block);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, TRAIL_BINDING, mTrailBuffer);
     }
 
-    void render(const component::mesh& mesh, const component::camera& camera) {
-        glBindVertexArray(mesh.VAO);
-        const auto& s = particleShader.get();
-        glUseProgram(s);
-        glUniformMatrix4fv(glGetUniformLocation(s, "uProj"), 1, GL_FALSE, glm::value_ptr(camera.proj));
-        glUniformMatrix4fv(glGetUniformLocation(s, "uView"), 1, GL_FALSE, glm::value_ptr(camera.view));
-        glDrawArraysInstanced(GL_TRIANGLES, 0, mesh.vertexCount, pCount * trailSize);
+    void render(const component::mesh& mesh) {
+        GLState::get().bindVertexArray(mesh.VAO);
+        GLState::get().useProgram(particleShader.get());
+        glUniform1i(glGetUniformLocation(particleShader.get(), "head"), static_cast<GLint>(mHead));
+        if (mesh.bIndices)
+            glDrawElementsInstancedBaseVertex(GL_TRIANGLES, mesh.indexCount, GL_UNSIGNED_INT, (void *)(mesh.firstIndex * sizeof(GLuint)), instanceCount, mesh.baseVertex);
+        else
+            glDrawArraysInstanced(GL_TRIANGLES, mesh.baseVertex, mesh.vertexCount, instanceCount);
     }
 
     ~Particles() {
-        glDeleteBuffers(1, &b);
+        GpuMemory::get().deleteBuffers(1, &mTrailBuffer);
     }
 };
 
@@ -0,0 +1,225 @@
+#ifndef RENDERGRAPH_H
+#define RENDERGRAPH_H
+
+#include <glad/glad.h>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <iostream>
+#include "trace.h"
+#include "glstate.h"
+#include "gpumemory.h"
+
+/**
+ * Runs the passes of a frame and hands out the render targets they use.
+ * Every frame passes are added with the resources they read and write, then execute() runs them
+ * in order, each in a GPU trace zone with its name. Resources made with create() are transient:
+ * right before the first pass using one it gets a target from a pool keyed by format and size,
+ * which goes back to the pool after the last pass using it. Resources whose passes don't overlap
+ * therefore share a target. Targets a frame didn't use are deleted after it, so resizing
+ * reallocates once on the next frame instead of on every resize event.
+ */
+class RenderGraph
+{
+public:
+    using resource = unsigned int;
+
+    struct targetDesc
+    {
+        GLenum format;
+        GLsizei width, height;
+        // Also attach a depth stencil renderbuffer
+        bool bDepth{false};
+
+        bool operator==(const targetDesc&) const = default;
+    };
+
+private:
+    struct target
+    {
+        targetDesc desc;
+        unsigned int framebuffer{0}, texture{0}, depth{0};
+        // Held by a resource of the pass being executed
+        bool bInUse{false};
+        // Held by any resource this frame
+        bool bUsed{false};
+    };
+
+    struct resourceInfo
+    {
+        targetDesc desc;
+        unsigned int framebuffer{0}, texture{0};
+        // Imported targets are owned by someone else and never pooled
+        bool bImported{false};
+        // Index into mPool while acquired
+        std::size_t target{0};
+        // First and last pass using the resource
+        std::size_t first{0}, last{0};
+        bool bReferenced{false};
+    };
+
+    struct pass
+    {
+        const char* name;
+        std::vector<resource> inputs, outputs;
+        std::function<void(RenderGraph&)> execute;
+    };
+
+    std::vector<target> mPool;
+    std::vector<resourceInfo> mResources;
+    std::vector<pass> mPasses;
+    // Resources of the last frame that got a target another resource had already used
+    std::size_t mAliased{0};
+
+    static target createTarget(const targetDesc& desc) {
+        target t{desc};
+        glCreateTextures(GL_TEXTURE_2D, 1, &t.texture);
+        GpuMemory::get().textureStorage2D("RenderGraph", t.texture, 1, desc.format, desc.width, desc.height);
+        glTextureParameteri(t.texture, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTextureParameteri(t.texture, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTextureParameteri(t.texture, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTextureParameteri(t.texture, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+        glCreateFramebuffers(1, &t.framebuffer);
+        glNamedFramebufferTexture(t.framebuffer, GL_COLOR_ATTACHMENT0, t.texture, 0);
+        if (desc.bDepth) {
+            glCreateRenderbuffers(1, &t.depth);
+            GpuMemory::get().renderbufferStorage("RenderGraph", t.depth, GL_DEPTH24_STENCIL8, desc.width, desc.height);
+            glNamedFramebufferRenderbuffer(t.framebuffer, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, t.depth);
+        }
+
+        const auto status = glCheckNamedFramebufferStatus(t.framebuffer, GL_FRAMEBUFFER);
+        if (status != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "RenderGraph: framebuffer failed with status: " << status << std::endl;
+        return t;
+    }
+
+    static void destroyTarget(const target& t) {
+        glDeleteFramebuffers(1, &t.framebuffer);
+        GpuMemory::get().deleteTextures(1, &t.texture);
+        if (t.depth != 0)
+            GpuMemory::get().deleteRenderbuffers(1, &t.depth);
+    }
+
+    // Deletes the pool targets matching bUnneeded(target)
+    template <typename F>
+    void trim(F&& bUnneeded) {
+        const auto count = mPool.size();
+        std::erase_if(mPool, [&](const target& t) {
+            if (!bUnneeded(t))
+                return false;
+            destroyTarget(t);
+            return true;
+        });
+        // Deleting unbinds them, and their names may come back for new objects
+        if (mPool.size() != count)
+            GLState::get().invalidate();
+    }
+
+    std::size_t acquire(const targetDesc& desc) {
+        for (std::size_t i{0}; i < mPool.size(); ++i) {
+            auto& t = mPool[i];
+            if (t.bInUse || !(t.desc == desc))
+                continue;
+            mAliased += t.bUsed;
+            t.bInUse = t.bUsed = true;
+            return i;
+        }
+        mPool.push_back(createTarget(desc));
+        mPool.back().bInUse = mPool.back().bUsed = true;
+        return mPool.size() - 1;
+    }
+
+public:
+    RenderGraph() = default;
+
+    RenderGraph(const RenderGraph&) = delete;
+    RenderGraph(RenderGraph&&) = delete;
+    void operator=(const RenderGraph&) = delete;
+    void operator=(RenderGraph&&) = delete;
+
+    // A transient target, only valid during the passes using it
+    resource create(const targetDesc& desc) {
+        mResources.push_back({desc});
+        return static_cast<resource>(mResources.size() - 1);
+    }
+
+    // A target owned elsewhere, like the window (framebuffer 0)
+    resource importTarget(unsigned int framebuffer, unsigned int texture = 0) {
+        mResources.push_back({{}, framebuffer, texture, true});
+        return static_cast<resource>(mResources.size() - 1);
+    }
+
+    /**
+     * Adds a pass run by the next execute(), after the passes added before it.
+     * inputs and outputs are the resources it reads and writes, execute(graph) issues
+     * its commands and may only look up the targets of those.
+     */
+    void addPass(const char* name, std::vector<resource> inputs, std::vector<resource> outputs, std::function<void(RenderGraph&)> execute) {
+        mPasses.push_back({name, std::move(inputs), std::move(outputs), std::move(execute)});
+    }
+
+    unsigned int framebuffer(resource r) const { return mResources[r].framebuffer; }
+    unsigned int texture(resource r) const { return mResources[r].texture; }
+
+    // Runs and then forgets the added passes and resources
+    void execute() {
+        for (std::size_t p{0}; p < mPasses.size(); ++p) {
+            for (const auto* list : {&mPasses[p].inputs, &mPasses[p].outputs}) {
+                for (auto r : *list) {
+                    auto& info = mResources[r];
+                    if (!info.bReferenced)
+                        info.first = p;
+                    info.last = p;
+                    info.bReferenced = true;
+                }
+            }
+        }
+
+        // Make room before allocating, like after a resize
+        trim([&](const target& t) {
+            return std::none_of(mResources.begin(), mResources.end(), [&](const resourceInfo& info) {
+                return info.bReferenced && !info.bImported && info.desc == t.desc;
+            });
+        });
+
+        mAliased = 0;
+        for (std::size_t p{0}; p < mPasses.size(); ++p) {
+            for (auto& info : mResources) {
+                if (!info.bReferenced || info.bImported || info.first != p)
+                    continue;
+                info.target = acquire(info.desc);
+                info.framebuffer = mPool[info.target].framebuffer;
+                info.texture = mPool[info.target].texture;
+            }
+
+            {
+                TraceZone zone{mPasses[p].name, true};
+                mPasses[p].execute(*this);
+            }
+
+            for (auto& info : mResources)
+                if (info.bReferenced && !info.bImported && info.last == p)
+                    mPool[info.target].bInUse = false;
+        }
+
+        // Surplus targets of a kind still in use
+        trim([](const target& t) { return !t.bUsed; });
+        for (auto& t : mPool)
+            t.bUsed = false;
+
+        mPasses.clear();
+        mResources.clear();
+    }
+
+    // Targets in the pool, all of them used by the last frame
+    std::size_t targets() const { return mPool.size(); }
+    std::size_t aliased() const { return mAliased; }
+
+    ~RenderGraph() {
+        for (const auto& t : mPool)
+            destroyTarget(t);
+    }
+};
+
+#endif // RENDERGRAPH_H
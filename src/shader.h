@@ -28,7 +28,9 @@ public:
 
 private:
     bool bValid = false;
-    int program;
+    int program{0};
+
+    Shader() = default;
 
 public:
     Shader(const std::string& vPath, const std::string& fPath, envVarsT environmentVariables = {})
@@ -118,6 +120,50 @@ public:
             << program << std::endl;
     }
 
+    // Compute shader program, sharing the #include and $VAR handling with the other shaders.
+    static Shader compute(const std::string& cPath, envVarsT environmentVariables = {})
+    {
+        Shader shader{};
+        std::string computeSource{};
+        if (!shader.appendFile(computeSource, cPath, environmentVariables))
+        {
+            std::cout << "SHADER ERROR: Compute path not found." << std::endl;
+            return shader;
+        }
+
+        auto cSourcePtr = computeSource.c_str();
+        int computeShader = glCreateShader(GL_COMPUTE_SHADER);
+        glShaderSource(computeShader, 1, &cSourcePtr, NULL);
+        glCompileShader(computeShader);
+        int success;
+        char infoLog[512];
+        glGetShaderiv(computeShader, GL_COMPILE_STATUS, &success);
+        if (!success)
+        {
+            glGetShaderInfoLog(computeShader, 512, NULL, infoLog);
+            std::cout << "ERROR::SHADER::COMPUTE::COMPILATION_FAILED\n"
+                      << infoLog << std::endl;
+            return shader;
+        }
+        shader.program = glCreateProgram();
+        glAttachShader(shader.program, computeShader);
+        glLinkProgram(shader.program);
+        glGetProgramiv(shader.program, GL_LINK_STATUS, &success);
+        if (!success)
+        {
+            glGetProgramInfoLog(shader.program, 512, NULL, infoLog);
+            std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n"
+                      << infoLog << std::endl;
+            return shader;
+        }
+        glDeleteShader(computeShader);
+
+        shader.bValid = true;
+        std::cout << "SHADERINFO: Shader with " << cPath.substr(cPath.find_last_of('/') + 1)
+            << " created with program id: " << shader.program << std::endl;
+        return shader;
+    }
+
     int get() const { return program; }
     int operator* () const { return get(); }
 
@@ -1,9 +1,9 @@
-#version 330 core
+#version 420 core
 layout (location = 0) in vec3 aPos;
-layout (location = 1) in vec3 aNormal;
+// Custom #include (see shader.h)
+#include "src/shaders/vertexformat.vert"
 
-uniform mat4 uProj;
-uniform mat4 uView;
+#include "src/shaders/camera.vert"
 uniform mat4 uModel;
 // uniform ivec2 screenSize;
 
@@ -13,7 +13,7 @@ void main()
 {
     // float aspectRatio = float(screenSize.x) / screenSize.y;
     // Multiply with normal matrix (transpose inverse without scale)
-    normal = aNormal;
+    normal = vertexNormal();
     mat4 viewModel = uView * uModel;
     // viewModel[3].xyz = vec3(-aspectRatio, 0.0, -10.0);
     viewModel[3].xyz = vec3(0.0, 0.0, -10.0);
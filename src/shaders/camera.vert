@@ -0,0 +1,6 @@
+// Per frame camera data, written through the upload ring every frame (see App::gameloop)
+layout (std140, binding = 0) uniform Camera
+{
+    mat4 uProj;
+    mat4 uView;
+};
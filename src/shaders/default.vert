@@ -1,11 +1,10 @@
-#version 330 core
+#version 420 core
 // Custom #include (see shader.h)
 // #include "src/shaders/quat.vert"
 layout (location = 0) in vec3 aPos;
-layout (location = 1) in vec3 aNormal;
+#include "src/shaders/vertexformat.vert"
 
-uniform mat4 uProj;
-uniform mat4 uView;
+#include "src/shaders/camera.vert"
 uniform mat4 uModel;
 
 out vec3 normal;
@@ -13,6 +12,6 @@ out vec3 normal;
 void main()
 {
     // Multiply with normal matrix (transpose inverse without scale)
-    normal = aNormal;
+    normal = vertexNormal();
     gl_Position = uProj * uView * uModel * vec4(aPos, 1.0);
 }
\ No newline at end of file
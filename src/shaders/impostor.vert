@@ -0,0 +1,46 @@
+#version 430 core
+// Custom #include (see shader.h)
+#include "src/shaders/camera.vert"
+
+// Bodies drawn by this draw call, written every frame by SphereImpostors::draw (see impostors.h)
+struct Impostor
+{
+    // World space center and radius
+    vec4 sphere;
+    vec4 color;
+};
+
+layout (std430, binding = 10) readonly buffer Impostors
+{
+    Impostor impostors[];
+};
+
+out vec3 rayTarget;
+flat out vec4 sphere;
+flat out vec3 eyePos;
+flat out vec3 objectColor;
+
+// One quad per sphere, drawn as a 4 vertex triangle strip without vertex buffers.
+// The quad faces the eye and touches the front of the sphere, covering every ray that hits it.
+void main()
+{
+    sphere = impostors[gl_InstanceID].sphere;
+    objectColor = impostors[gl_InstanceID].color.rgb;
+    // The view matrix is rigid, so the eye is the inverse of its translation
+    eyePos = -transpose(mat3(uView)) * uView[3].xyz;
+
+    vec3 toCenter = sphere.xyz - eyePos;
+    float dist = length(toCenter);
+    vec3 axis = toCenter / dist;
+    vec3 up = abs(axis.y) < 0.99 ? vec3(0.0, 1.0, 0.0) : vec3(1.0, 0.0, 0.0);
+    vec3 right = normalize(cross(axis, up));
+    up = cross(right, axis);
+
+    // Size of the cone of rays touching the sphere, at the plane in front of it
+    float planeDist = dist - sphere.w;
+    float halfSize = planeDist * sphere.w / sqrt(dist * dist - sphere.w * sphere.w);
+    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 2.0 - 1.0;
+
+    rayTarget = eyePos + axis * planeDist + (right * corner.x + up * corner.y) * halfSize;
+    gl_Position = uProj * uView * vec4(rayTarget, 1.0);
+}
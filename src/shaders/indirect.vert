@@ -0,0 +1,24 @@
+#version 430 core
+layout (location = 0) in vec3 aPos;
+// Per instance, set from the baseInstance of the draw command (see cull.comp)
+layout (location = 4) in uint aObjectIndex;
+// Custom #include (see shader.h)
+#include "src/shaders/vertexformat.vert"
+
+#include "src/shaders/camera.vert"
+#include "src/shaders/objects.vert"
+
+out vec3 normal;
+out vec3 fragPos;
+flat out vec3 objectColor;
+
+// phong.vert for GPU culled draws, reading the model matrix and color from the object buffer
+void main()
+{
+    mat4 model = objects[aObjectIndex].model;
+    normal = mat3(transpose(inverse(model))) * vertexNormal();
+    objectColor = objects[aObjectIndex].color.rgb;
+
+    fragPos = (model * vec4(aPos, 1.0)).xyz;
+    gl_Position = uProj * uView * vec4(fragPos, 1.0);
+}
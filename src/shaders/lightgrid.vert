@@ -0,0 +1,44 @@
+// Lights and their view clusters, written every frame by LightClusters::update (see lightclusters.h)
+struct Light
+{
+    // World space position and the distance where the light has faded out (0 reaches everything)
+    vec4 posRadius;
+    vec4 color;
+};
+
+layout (std140, binding = 1) uniform LightGrid
+{
+    // Tiles across, tiles up, depth slices and light slots per cluster
+    uvec4 clusterGrid;
+    // Near plane, far plane, log(far / near) and tile size in pixels
+    vec4 clusterDepth;
+};
+
+layout (std430, binding = 8) readonly buffer Lights
+{
+    Light lights[];
+};
+
+// Every cluster holds its light count followed by clusterGrid.w light indices
+layout (std430, binding = 9) buffer Clusters
+{
+    uint clusterLights[];
+};
+
+// Cluster of a window position and view space depth (negative in front of the camera).
+// Depth slices grow exponentially, so clusters stay roughly cube shaped.
+uint clusterIndex(vec2 fragCoord, float viewZ)
+{
+    uvec2 tile = min(uvec2(fragCoord / clusterDepth.w), clusterGrid.xy - 1u);
+    float slice = log(max(-viewZ, clusterDepth.x) / clusterDepth.x) / clusterDepth.z * float(clusterGrid.z);
+    return (min(uint(slice), clusterGrid.z - 1u) * clusterGrid.y + tile.y) * clusterGrid.x + tile.x;
+}
+
+// Smooth fade to zero at the light's radius
+float lightFalloff(float dist, float radius)
+{
+    if (radius <= 0.0)
+        return 1.0;
+    float window = clamp(1.0 - pow(dist / radius, 4.0), 0.0, 1.0);
+    return window * window;
+}
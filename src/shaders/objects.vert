@@ -0,0 +1,13 @@
+// Per object data for GPU culled draws, written every frame by GpuCulling::cull (see gpuculling.h)
+struct Object
+{
+    mat4 model;
+    // World space bounding sphere, negative radius when the object is hidden
+    vec4 sphere;
+    vec4 color;
+};
+
+layout (std430, binding = 3) readonly buffer Objects
+{
+    Object objects[];
+};
@@ -1,15 +1,23 @@
 #version 430 core
 layout (location = 0) in vec3 aPos;
-layout (location = 1) in vec3 aNormal;
+// Custom #include (see shader.h)
+#include "src/shaders/vertexformat.vert"
 
-uniform mat4 uProj;
-uniform mat4 uView;
+#include "src/shaders/camera.vert"
 layout (std430, binding = 2) buffer ParticleData
 {
-    vec4 pos[$PCOUNT * $TLENGTH];
     vec4 scale[$PCOUNT];
     vec4 color[$PCOUNT];
+    // Bit s of a particle's words is set when its sample in row s is hidden
+    uint hidden[$PCOUNT * $MASKWORDS];
 };
+// Ring of trail rows, the sample in row s of particle p is at s * $PCOUNT + p (see particles.h)
+layout (std430, binding = 11) readonly buffer TrailData
+{
+    vec4 trail[$TLENGTH * $PCOUNT];
+};
+// Row of the newest samples
+uniform int head;
 
 out vec3 normal;
 out vec3 iColor;
@@ -18,16 +26,22 @@ out vec4 fragPos;
 void main()
 {
     int pIndex = gl_InstanceID / $TLENGTH;
+    // Oldest sample first
+    int row = (head + 1 + gl_InstanceID % $TLENGTH) % $TLENGTH;
+    vec3 pos = trail[row * $PCOUNT + pIndex].xyz;
 
     // Multiply with normal matrix (transpose inverse without scale)
-    normal = aNormal;
+    normal = vertexNormal();
     iColor = color[pIndex].xyz;
     
     mat4 model = mat4(mat3(1.0));
     for (int i = 0; i < 3; i++)
         model[i][i] = scale[pIndex][i] * 0.2;
-    model[3].xyz = pos[gl_InstanceID].xyz;
+    model[3].xyz = pos;
 
     fragPos = model * vec4(aPos, 1.0);
     gl_Position = uProj * uView * fragPos;
+    // Hidden behind an occluder (see occlusion.h), so clip the whole sphere
+    if ((hidden[pIndex * $MASKWORDS + row / 32] & (1u << (row % 32))) != 0u)
+        gl_Position = vec4(0.0, 0.0, 2.0, 1.0);
 }
\ No newline at end of file
@@ -1,10 +1,14 @@
-#version 330 core
+#version 430 core
+// Custom #include (see shader.h)
+#include "src/shaders/camera.vert"
+#include "src/shaders/lightgrid.vert"
+#include "src/shaders/phonglight.vert"
+
 in vec3 normal;
 in vec3 fragPos;
+// From the vertex shader, so per object colors also work for GPU culled draws
+flat in vec3 objectColor;
 
-uniform vec3 lightPos;
-// uniform vec3 lightColor = vec3(1, 1, 1);
-uniform vec3 color;
 uniform vec3 cameraPos;
 
 out vec4 FragColor;
@@ -12,19 +16,7 @@ out vec4 FragColor;
 void main()
 {
     vec3 norm = normalize(normal);
-    vec3 lightDir = normalize(lightPos - fragPos);
-
-    // Ambient light
-    float ambient = 0.1;
-
-    // Diffuse light
-    float diff = max(dot(norm, lightDir), 0.0);
-
-    // Specular light
     vec3 viewDir = normalize(cameraPos - fragPos);
-    vec3 reflectDir = reflect(-lightDir, norm);
-    float spec = pow(max(dot(viewDir, reflectDir), 0.0), 32) * 2.0;
 
-    float finalFactor = ambient + diff + spec;
-    FragColor = vec4(finalFactor * color, 1.0);
-}
\ No newline at end of file
+    FragColor = vec4(phongLight(norm, fragPos, viewDir, gl_FragCoord.xy) * objectColor, 1.0);
+}
@@ -1,18 +1,21 @@
-#version 330 core
+#version 420 core
 layout (location = 0) in vec3 aPos;
-layout (location = 1) in vec3 aNormal;
+// Custom #include (see shader.h)
+#include "src/shaders/vertexformat.vert"
 
-uniform mat4 uProj;
-uniform mat4 uView;
+#include "src/shaders/camera.vert"
 uniform mat4 uModel;
+uniform vec3 color;
 
 out vec3 normal;
 out vec3 fragPos;
+flat out vec3 objectColor;
 
 void main()
 {
     // Multiply with normal matrix (transpose inverse without translation)
-    normal = mat3(transpose(inverse(uModel))) * aNormal;
+    normal = mat3(transpose(inverse(uModel))) * vertexNormal();
+    objectColor = color;
 
     fragPos = (uModel * vec4(aPos, 1.0)).xyz;
     gl_Position = uProj * uView * vec4(fragPos, 1.0);
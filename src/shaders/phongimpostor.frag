@@ -0,0 +1,18 @@
+#version 430 core
+// Custom #include (see shader.h)
+#include "src/shaders/camera.vert"
+#include "src/shaders/lightgrid.vert"
+#include "src/shaders/phonglight.vert"
+#include "src/shaders/sphereraycast.vert"
+
+out vec4 FragColor;
+
+// phong.frag for sphere impostors
+void main()
+{
+    vec3 fragPos, norm;
+    raycastSphere(fragPos, norm);
+    vec3 viewDir = normalize(eyePos - fragPos);
+
+    FragColor = vec4(phongLight(norm, fragPos, viewDir, gl_FragCoord.xy) * objectColor, 1.0);
+}
@@ -0,0 +1,27 @@
+// Phong lighting from the lights reaching the fragment's cluster (see lights.comp).
+// Needs camera.vert and lightgrid.vert, shared by phong.frag and the sphere impostors.
+vec3 phongLight(vec3 norm, vec3 fragPos, vec3 viewDir, vec2 fragCoord)
+{
+    // Ambient light
+    vec3 light = vec3(0.1);
+
+    // Only the lights reaching this fragment's cluster (see lights.comp)
+    uint base = clusterIndex(fragCoord, (uView * vec4(fragPos, 1.0)).z) * (clusterGrid.w + 1u);
+    uint count = clusterLights[base];
+    for (uint i = 0u; i < count; ++i)
+    {
+        Light l = lights[clusterLights[base + 1u + i]];
+        vec3 toLight = l.posRadius.xyz - fragPos;
+        vec3 lightDir = normalize(toLight);
+
+        // Diffuse light
+        float diff = max(dot(norm, lightDir), 0.0);
+
+        // Specular light
+        vec3 reflectDir = reflect(-lightDir, norm);
+        float spec = pow(max(dot(viewDir, reflectDir), 0.0), 32) * 2.0;
+
+        light += (diff + spec) * lightFalloff(length(toLight), l.posRadius.w) * l.color.rgb;
+    }
+    return light;
+}
@@ -6,17 +6,20 @@ in vec2 uv;
 uniform sampler2D tex;
   
 uniform bool horizontal;
+// Corner of tex holding the image, taps outside it are clamped to its edge
+uniform vec2 uvScale = vec2(1.0);
 uniform float weight[5] = float[] (0.227027, 0.1945946, 0.1216216, 0.054054, 0.016216);
 
 void main()
 {             
     vec2 tex_offset = 1.0 / textureSize(tex, 0); // gets size of single texel
+    vec2 uvMax = uvScale - 0.5 * tex_offset;
     vec3 result = texture(tex, uv).rgb * weight[0]; // current fragment's contribution
     if(horizontal)
     {
         for(int i = 1; i < 5; ++i)
         {
-            result += texture(tex, uv + vec2(tex_offset.x * i, 0.0)).rgb * weight[i];
+            result += texture(tex, min(uv + vec2(tex_offset.x * i, 0.0), uvMax)).rgb * weight[i];
             result += texture(tex, uv - vec2(tex_offset.x * i, 0.0)).rgb * weight[i];
         }
     }
@@ -24,7 +27,7 @@ void main()
     {
         for(int i = 1; i < 5; ++i)
         {
-            result += texture(tex, uv + vec2(0.0, tex_offset.y * i)).rgb * weight[i];
+            result += texture(tex, min(uv + vec2(0.0, tex_offset.y * i), uvMax)).rgb * weight[i];
             result += texture(tex, uv - vec2(0.0, tex_offset.y * i)).rgb * weight[i];
         }
     }
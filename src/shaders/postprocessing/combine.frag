@@ -6,12 +6,21 @@ in vec2 uv;
 uniform sampler2D tex;
 uniform sampler2D bloom;
 uniform float exposure = 3.0;
+// Corners of tex and bloom holding the images
+uniform vec2 texScale = vec2(1.0);
+uniform vec2 bloomScale = vec2(1.0);
+
+// Samples the corner of a texture as if it was the whole texture
+vec3 sampleCorner(sampler2D t, vec2 scale)
+{
+    return texture(t, min(uv * scale, scale - 0.5 / textureSize(t, 0))).rgb;
+}
 
 void main()
 {             
     const float gamma = 2.2;
-    vec3 hdrColor = texture(tex, uv).rgb;      
-    vec3 bloomColor = texture(bloom, uv).rgb;
+    vec3 hdrColor = sampleCorner(tex, texScale);
+    vec3 bloomColor = sampleCorner(bloom, bloomScale);
     hdrColor += bloomColor; // additive blending
     // tone mapping
     vec3 result = vec3(1.0) - exp(-hdrColor * exposure);
@@ -0,0 +1,25 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec2 uv;
+
+uniform sampler2D tex;
+// Corner of tex holding the image, taps outside it are clamped to its edge
+uniform vec2 uvScale = vec2(1.0);
+
+vec3 tap(vec2 offset, vec2 texel)
+{
+    return texture(tex, min(uv + offset * texel, uvScale - 0.5 * texel)).rgb;
+}
+
+// Dual filter downsample: the center and four diagonal taps, each a bilinear average of 2x2 texels
+void main()
+{
+    vec2 texel = 1.0 / textureSize(tex, 0);
+    vec3 result = tap(vec2(0.0), texel) * 4.0;
+    result += tap(vec2(-1.0, -1.0), texel);
+    result += tap(vec2(1.0, -1.0), texel);
+    result += tap(vec2(-1.0, 1.0), texel);
+    result += tap(vec2(1.0, 1.0), texel);
+    FragColor = vec4(result / 8.0, 1.0);
+}
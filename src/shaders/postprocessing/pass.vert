@@ -4,8 +4,11 @@ layout (location = 2) in vec2 aUV;
 
 out vec2 uv;
 
+// Part of the input texture in use, see Bloom::setRenderSize()
+uniform vec2 uvScale = vec2(1.0);
+
 void main()
 {
-    uv = aUV;
+    uv = aUV * uvScale;
     gl_Position = vec4(aPos, 1.0);
 }
\ No newline at end of file
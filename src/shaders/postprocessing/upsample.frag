@@ -0,0 +1,28 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec2 uv;
+
+uniform sampler2D tex;
+// Corner of tex holding the image, taps outside it are clamped to its edge
+uniform vec2 uvScale = vec2(1.0);
+
+vec3 tap(vec2 offset, vec2 texel)
+{
+    return texture(tex, min(uv + offset * texel, uvScale - 0.5 * texel)).rgb;
+}
+
+// Dual filter upsample: a tent of four axis taps and four (twice as heavy) diagonal taps
+void main()
+{
+    vec2 texel = 1.0 / textureSize(tex, 0);
+    vec3 result = tap(vec2(-1.0, 0.0), texel);
+    result += tap(vec2(1.0, 0.0), texel);
+    result += tap(vec2(0.0, -1.0), texel);
+    result += tap(vec2(0.0, 1.0), texel);
+    result += tap(vec2(-0.5, -0.5), texel) * 2.0;
+    result += tap(vec2(0.5, -0.5), texel) * 2.0;
+    result += tap(vec2(-0.5, 0.5), texel) * 2.0;
+    result += tap(vec2(0.5, 0.5), texel) * 2.0;
+    FragColor = vec4(result / 12.0, 1.0);
+}
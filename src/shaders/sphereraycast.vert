@@ -0,0 +1,25 @@
+// Ray cast of the sphere behind an impostor quad (see impostor.vert).
+// The hit is never in front of the quad, which keeps early depth testing with depth_greater.
+in vec3 rayTarget;
+flat in vec4 sphere;
+flat in vec3 eyePos;
+flat in vec3 objectColor;
+
+layout (depth_greater) out float gl_FragDepth;
+
+// Discards rays missing the sphere, writes the depth of the hit and returns its position and normal
+void raycastSphere(out vec3 fragPos, out vec3 normal)
+{
+    vec3 dir = normalize(rayTarget - eyePos);
+    vec3 fromCenter = eyePos - sphere.xyz;
+    float b = dot(fromCenter, dir);
+    float h = b * b - dot(fromCenter, fromCenter) + sphere.w * sphere.w;
+    if (h < 0.0)
+        discard;
+
+    fragPos = eyePos + dir * (-b - sqrt(h));
+    normal = (fragPos - sphere.xyz) / sphere.w;
+
+    vec4 clipPos = uProj * uView * vec4(fragPos, 1.0);
+    gl_FragDepth = clipPos.z / clipPos.w * 0.5 + 0.5;
+}
@@ -1,4 +1,6 @@
 #version 330 core
+// Custom #include (see shader.h)
+#include "src/shaders/sunlight.vert"
 
 in vec3 normal;
 in vec3 fragPos;
@@ -12,7 +14,5 @@ void main()
 {
     vec3 norm = normalize(normal);
     vec3 viewDir = normalize(cameraPos - fragPos);
-    float fresnel = 1.0 - pow(max(1.0 - dot(viewDir, norm), 0.0), 4.0);
-    vec3 color = mix(vec3(1.0, 0.2, 0.0), vec3(1.0, 0.8, 0.3), fresnel);
-    FragColor = vec4(color * 3.0, 1.0);
-}
\ No newline at end of file
+    FragColor = vec4(sunLight(norm, viewDir), 1.0);
+}
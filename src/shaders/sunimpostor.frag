@@ -0,0 +1,17 @@
+#version 430 core
+// Custom #include (see shader.h)
+#include "src/shaders/camera.vert"
+#include "src/shaders/sunlight.vert"
+#include "src/shaders/sphereraycast.vert"
+
+out vec4 FragColor;
+
+// sun.frag for sphere impostors
+void main()
+{
+    vec3 fragPos, norm;
+    raycastSphere(fragPos, norm);
+    vec3 viewDir = normalize(eyePos - fragPos);
+
+    FragColor = vec4(sunLight(norm, viewDir), 1.0);
+}
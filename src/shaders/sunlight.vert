@@ -0,0 +1,7 @@
+// Glowing sun surface, hotter where it faces the viewer. Shared by sun.frag and the sphere impostors.
+vec3 sunLight(vec3 norm, vec3 viewDir)
+{
+    float fresnel = 1.0 - pow(max(1.0 - dot(viewDir, norm), 0.0), 4.0);
+    vec3 color = mix(vec3(1.0, 0.2, 0.0), vec3(1.0, 0.8, 0.3), fresnel);
+    return color * 3.0;
+}
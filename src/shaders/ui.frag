@@ -2,11 +2,38 @@
 
 in vec2 uv;
 
+// Frame time graph, one texel per frame from oldest to newest. r = cpu ms, g = gpu ms (see framestats.h)
 uniform sampler2D tex;
+// Frame time at the top of the graph
+uniform float scaleMs;
+uniform float targetMs;
+// Cpu frame time p50, p95, p99 and max
+uniform vec4 percentiles;
 
 out vec4 FragColor;
 
 void main()
 {
-    FragColor = texture(tex, uv);
-}
\ No newline at end of file
+    int width = textureSize(tex, 0).x;
+    vec2 times = texelFetch(tex, ivec2(min(int(uv.x * width), width - 1), 0), 0).rg;
+    float ms = uv.y * scaleMs;
+    // Height of one pixel in ms, for one pixel thick lines
+    float pixel = fwidth(ms);
+
+    vec4 color = vec4(0.0, 0.0, 0.0, 0.4);
+    if (ms < times.r)
+        color = (times.r <= targetMs) ? vec4(0.2, 0.8, 0.2, 0.8)
+            : (times.r <= 2.0 * targetMs) ? vec4(0.9, 0.8, 0.1, 0.8)
+            : vec4(0.9, 0.2, 0.1, 0.9);
+    if (ms < times.g)
+        color = vec4(mix(color.rgb, vec3(0.2, 0.4, 1.0), 0.6), 0.8);
+
+    if (abs(ms - targetMs) < pixel)
+        color = vec4(1.0, 1.0, 1.0, 0.6);
+    // p50 white to max red
+    for (int i = 0; i < 4; ++i)
+        if (abs(ms - percentiles[i]) < pixel)
+            color = vec4(1.0, 1.0 - 0.3 * float(i), 1.0 - 0.3 * float(i), 0.9);
+
+    FragColor = color;
+}
@@ -0,0 +1,31 @@
+// Vertex normal input for both vertex layouts (see vertexformat.h)
+
+/** Normals are either full floats in location 1,
+ * or octahedral encoded in 2 x snorm16 in location 3.
+ * $OCTNORMALS picks one when the shader is built (see vertexformat::shaderVar),
+ * so a shader only draws meshes of the matching layout.
+ */
+#if $OCTNORMALS != 0
+layout (location = 3) in vec2 aOctNormal;
+
+vec3 octDecode(vec2 e)
+{
+    vec3 n = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
+vec3 vertexNormal()
+{
+    return octDecode(aOctNormal);
+}
+#else
+layout (location = 1) in vec3 aNormal;
+
+vec3 vertexNormal()
+{
+    return aNormal;
+}
+#endif
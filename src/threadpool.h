@@ -0,0 +1,112 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <cstddef>
+
+/**
+ * Fixed set of worker threads for splitting per frame work into batches.
+ * The calling thread works on the batches as well, so a pool without workers
+ * (single core machines) just runs everything inline.
+ */
+class ThreadPool
+{
+private:
+    std::vector<std::thread> mWorkers;
+    std::deque<std::function<void()>> mJobs;
+    std::mutex mMutex;
+    std::condition_variable mWake;
+    bool bStop{false};
+
+    ThreadPool(unsigned int workers) {
+        for (unsigned int i{0}; i < workers; ++i)
+            mWorkers.emplace_back([this]() { work(); });
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool(ThreadPool&&) = delete;
+
+    void work() {
+        while (true) {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock{mMutex};
+                mWake.wait(lock, [this]() { return bStop || !mJobs.empty(); });
+                if (bStop && mJobs.empty())
+                    return;
+                job = std::move(mJobs.front());
+                mJobs.pop_front();
+            }
+            job();
+        }
+    }
+
+public:
+    // Singleton interface
+    static ThreadPool& get() {
+        static ThreadPool instance{std::max(std::thread::hardware_concurrency(), 1u) - 1};
+        return instance;
+    }
+
+    std::size_t workerCount() const { return mWorkers.size(); }
+
+    /**
+     * Calls fn(begin, end) for batches of at most batchSize indices in [0, count)
+     * and returns once every batch is done. Batches may run on any thread, in any order.
+     */
+    template <typename F>
+    void parallelFor(std::size_t count, std::size_t batchSize, F&& fn) {
+        batchSize = std::max<std::size_t>(batchSize, 1);
+        const auto batches = (count + batchSize - 1) / batchSize;
+        if (batches <= 1 || mWorkers.empty()) {
+            if (count != 0)
+                fn(std::size_t{0}, count);
+            return;
+        }
+
+        std::atomic<std::size_t> next{0};
+        auto runBatches = [&]() {
+            for (std::size_t begin; (begin = next.fetch_add(batchSize)) < count;)
+                fn(begin, std::min(begin + batchSize, count));
+        };
+
+        const auto helpers = std::min(mWorkers.size(), batches - 1);
+        std::size_t remaining{helpers};
+        std::mutex doneMutex;
+        std::condition_variable done;
+        {
+            std::lock_guard<std::mutex> lock{mMutex};
+            for (std::size_t i{0}; i < helpers; ++i)
+                mJobs.emplace_back([&]() {
+                    runBatches();
+                    std::lock_guard<std::mutex> doneLock{doneMutex};
+                    if (--remaining == 0)
+                        done.notify_one();
+                });
+        }
+        mWake.notify_all();
+
+        runBatches();
+        std::unique_lock<std::mutex> lock{doneMutex};
+        done.wait(lock, [&]() { return remaining == 0; });
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock{mMutex};
+            bStop = true;
+        }
+        mWake.notify_all();
+        for (auto& worker : mWorkers)
+            worker.join();
+    }
+};
+
+#endif // THREADPOOL_H
@@ -0,0 +1,249 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <glad/glad.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <cstdint>
+#include <chrono>
+#include <algorithm>
+#include "timer.h"
+
+/**
+ * Frame tracer.
+ * TraceZones record CPU time and optionally GPU time through GL_TIMESTAMP queries.
+ * The queries are only read once their results are available (a few frames later),
+ * so tracing never stalls the pipeline. The events of the last frames are kept and
+ * can be written as Chrome trace JSON, viewable in chrome://tracing or ui.perfetto.dev.
+ */
+class Tracer
+{
+public:
+    struct event
+    {
+        const char* name;
+        // Microseconds since the tracer was created
+        std::int64_t start, duration;
+        std::uint64_t frame;
+        // 0 is the GPU, CPU threads count from 1
+        unsigned int thread;
+    };
+
+    // Frames of events kept for writeChrome()
+    static constexpr std::uint64_t MAX_FRAMES = 300;
+    // Frames between GPU / CPU clock calibrations
+    static constexpr std::uint64_t CALIBRATION_INTERVAL = 60;
+
+private:
+    struct gpuZone
+    {
+        const char* name;
+        GLuint begin, end;
+        std::uint64_t frame;
+    };
+
+    Timer mEpoch{};
+    std::uint64_t mFrame{0};
+    // Kept events by frame, mEvents[i] holds frame mFirstFrame + i, so one frame is found without a scan
+    std::deque<std::vector<event>> mEvents;
+    std::uint64_t mFirstFrame{0};
+    std::mutex mEventMutex;
+    std::vector<gpuZone> mPending;
+    std::vector<GLuint> mFreeQueries;
+    // GPU timestamp minus CPU time, both in nanoseconds
+    std::int64_t mGpuOffset{0};
+    bool bCalibrated{false};
+    std::atomic<unsigned int> mThreadCount{0};
+
+    Tracer() = default;
+    Tracer(const Tracer&) = delete;
+    Tracer(Tracer&&) = delete;
+
+    void calibrate() {
+        GLint64 gpuTime;
+        glGetInteger64v(GL_TIMESTAMP, &gpuTime);
+        mGpuOffset = gpuTime - mEpoch.elapsed<std::chrono::nanoseconds>();
+        bCalibrated = true;
+    }
+
+    // Collects the GPU zones that have finished
+    void resolve() {
+        for (auto it{mPending.begin()}; it != mPending.end();) {
+            GLint available{GL_FALSE};
+            glGetQueryObjectiv(it->end, GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available) {
+                ++it;
+                continue;
+            }
+
+            GLuint64 begin, end;
+            glGetQueryObjectui64v(it->begin, GL_QUERY_RESULT, &begin);
+            glGetQueryObjectui64v(it->end, GL_QUERY_RESULT, &end);
+            record({it->name, (static_cast<std::int64_t>(begin) - mGpuOffset) / 1000, static_cast<std::int64_t>(end - begin) / 1000, it->frame, 0});
+            mFreeQueries.push_back(it->begin);
+            mFreeQueries.push_back(it->end);
+            it = mPending.erase(it);
+        }
+    }
+
+public:
+    // Singleton interface
+    static Tracer& get() {
+        static Tracer instance{};
+        return instance;
+    }
+
+    // Call once at the start of every frame
+    void beginFrame() {
+        if (!bCalibrated || mFrame % CALIBRATION_INTERVAL == 0)
+            calibrate();
+
+        ++mFrame;
+        resolve();
+
+        std::lock_guard<std::mutex> lock{mEventMutex};
+        for (; mFirstFrame + MAX_FRAMES < mFrame; ++mFirstFrame)
+            if (!mEvents.empty())
+                mEvents.pop_front();
+    }
+
+    std::uint64_t frame() const { return mFrame; }
+    std::int64_t now() const { return mEpoch.elapsed<std::chrono::microseconds>(); }
+
+    // Small id of the calling thread, used as the trace thread id
+    unsigned int thread() {
+        thread_local unsigned int id{++mThreadCount};
+        return id;
+    }
+
+    // Latest frame whose GPU zones have all been resolved
+    std::uint64_t gpuResolvedFrame() const {
+        auto frame = mFrame - 1;
+        for (const auto& z : mPending)
+            frame = std::min(frame, z.frame - 1);
+        return frame;
+    }
+
+    // Events of a frame that is still kept
+    std::vector<event> events(std::uint64_t frame) {
+        std::lock_guard<std::mutex> lock{mEventMutex};
+        if (frame < mFirstFrame || mFirstFrame + mEvents.size() <= frame)
+            return {};
+        return mEvents[frame - mFirstFrame];
+    }
+
+    void record(const event& e) {
+        std::lock_guard<std::mutex> lock{mEventMutex};
+        // GPU zones resolve late, their frame may be gone already
+        if (e.frame < mFirstFrame)
+            return;
+        const auto i = e.frame - mFirstFrame;
+        if (mEvents.size() <= i)
+            mEvents.resize(i + 1);
+        mEvents[i].push_back(e);
+    }
+
+    GLuint query() {
+        if (mFreeQueries.empty()) {
+            GLuint q;
+            glGenQueries(1, &q);
+            return q;
+        }
+        const auto q = mFreeQueries.back();
+        mFreeQueries.pop_back();
+        return q;
+    }
+
+    void queueGpuZone(const char* name, GLuint begin, GLuint end) {
+        mPending.push_back({name, begin, end, mFrame});
+    }
+
+    // Writes the kept frames as Chrome trace events
+    bool writeChrome(const std::string& file) {
+        std::ofstream ofs{file};
+        if (!ofs) {
+            std::cout << "Tracer couldn't open " << file << " for writing." << std::endl;
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock{mEventMutex};
+        ofs << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+            << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"GPU\"}}";
+        for (unsigned int t{1}; t <= mThreadCount; ++t)
+            ofs << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << t << ",\"args\":{\"name\":\"CPU " << t << "\"}}";
+        std::size_t count{0};
+        for (const auto& frame : mEvents) {
+            count += frame.size();
+            for (const auto& e : frame)
+                ofs << ",\n{\"name\":\"" << e.name << "\",\"cat\":\"" << (e.thread == 0 ? "gpu" : "cpu") << "\",\"ph\":\"X\",\"ts\":" << e.start
+                    << ",\"dur\":" << e.duration << ",\"pid\":1,\"tid\":" << e.thread << ",\"args\":{\"frame\":" << e.frame << "}}";
+        }
+        ofs << "\n]}\n";
+
+        std::cout << "Wrote " << count << " trace events from the last " << std::min(mFrame, MAX_FRAMES) << " frames to " << file << std::endl;
+        return true;
+    }
+
+    // Deletes the query objects, call before the context is destroyed
+    void deInit() {
+        for (const auto& z : mPending) {
+            glDeleteQueries(1, &z.begin);
+            glDeleteQueries(1, &z.end);
+        }
+        mPending.clear();
+        glDeleteQueries(static_cast<GLsizei>(mFreeQueries.size()), mFreeQueries.data());
+        mFreeQueries.clear();
+    }
+};
+
+/**
+ * Traces the time from construction until end() or destruction.
+ * Zones with bGpu also time the GL commands issued meanwhile, so they must be
+ * created on the thread owning the GL context.
+ */
+class TraceZone
+{
+private:
+    const char* mName;
+    Timer mTimer{};
+    std::int64_t mStart;
+    GLuint mEndQuery{0};
+    GLuint mBeginQuery{0};
+    bool bEnded{false};
+
+public:
+    explicit TraceZone(const char* name, bool bGpu = false)
+        : mName{name}, mStart{Tracer::get().now()}
+    {
+        if (bGpu) {
+            mBeginQuery = Tracer::get().query();
+            mEndQuery = Tracer::get().query();
+            glQueryCounter(mBeginQuery, GL_TIMESTAMP);
+        }
+    }
+
+    TraceZone(const TraceZone&) = delete;
+    void operator=(const TraceZone&) = delete;
+
+    void end() {
+        if (bEnded)
+            return;
+        bEnded = true;
+
+        auto& tracer = Tracer::get();
+        tracer.record({mName, mStart, mTimer.elapsed<std::chrono::microseconds>(), tracer.frame(), tracer.thread()});
+        if (mBeginQuery != 0) {
+            glQueryCounter(mEndQuery, GL_TIMESTAMP);
+            tracer.queueGpuZone(mName, mBeginQuery, mEndQuery);
+        }
+    }
+
+    ~TraceZone() { end(); }
+};
+
+#endif // TRACE_H
@@ -0,0 +1,147 @@
+#ifndef TRANSFORMHIERARCHY_H
+#define TRANSFORMHIERARCHY_H
+
+#include <entt/entt.hpp> // https://github.com/skypjack/entt
+#include <glm/glm.hpp>
+#include <vector>
+#include <unordered_map>
+#include <atomic>
+#include <iostream>
+#include "components.h"
+#include "threadpool.h"
+
+/**
+ * Keeps a cached world matrix (component::world) for every entity with a trans.
+ * Entities with a component::parent are placed relative to their parent.
+ *
+ * Entities are sorted by depth, so parents are always updated before their children.
+ * A matrix is only rebuilt when the entity's trans changed since the last update
+ * or its parent's matrix did, which means static entities cost a compare per frame
+ * and only moved subtrees are recomputed. Every depth level is split into batches
+ * that run in parallel.
+ */
+class TransformHierarchy
+{
+public:
+    // Entities per parallel batch
+    static constexpr std::size_t BATCH_SIZE = 256;
+
+private:
+    struct node
+    {
+        entt::entity entity;
+        entt::entity parent;
+    };
+
+    // Nodes by depth, roots first
+    std::vector<std::vector<node>> mLevels;
+    std::size_t mNodeCount{0};
+    bool bOrderDirty{true};
+    std::size_t mRecomputed{0};
+
+    void rebuild(entt::registry& EM) {
+        mLevels.clear();
+        mNodeCount = 0;
+
+        auto view = EM.view<component::trans>();
+        std::unordered_map<entt::entity, unsigned int> depths;
+        // Parent of an entity if it exists and has a transform
+        auto parentOf = [&](entt::entity entity) {
+            if (auto p = EM.try_get<component::parent>(entity); p != nullptr && EM.valid(p->entity) && EM.has<component::trans>(p->entity))
+                return p->entity;
+            return static_cast<entt::entity>(entt::null);
+        };
+        // Iterative so deep chains don't recurse
+        auto depthOf = [&](entt::entity entity) {
+            std::vector<entt::entity> chain{};
+            for (auto e{entity}; e != entt::null && depths.find(e) == depths.end(); e = parentOf(e))
+                chain.push_back(e);
+            for (auto it{chain.rbegin()}; it != chain.rend(); ++it) {
+                const auto p = parentOf(*it);
+                depths[*it] = (p == entt::null) ? 0 : depths[p] + 1;
+            }
+            return depths[entity];
+        };
+
+        for (auto entity : view) {
+            if (!EM.has<component::world>(entity))
+                EM.emplace<component::world>(entity);
+
+            const auto depth = depthOf(entity);
+            if (mLevels.size() <= depth)
+                mLevels.resize(depth + 1);
+            mLevels[depth].push_back({entity, parentOf(entity)});
+            ++mNodeCount;
+        }
+        bOrderDirty = false;
+    }
+
+    // Returns true if the world matrix was rebuilt
+    static bool updateNode(entt::registry& EM, const node& n) {
+        const auto& transform = EM.get<component::trans>(n.entity);
+        auto& world = EM.get<component::world>(n.entity);
+        const auto* parentWorld = (n.parent == entt::null) ? nullptr : &EM.get<component::world>(n.parent);
+        const auto parentVersion = parentWorld ? parentWorld->version : 0u;
+        if (!world.bForceRebuild && world.parentVersion == parentVersion && world.local == transform)
+            return false;
+
+        world.local = transform;
+        world.mat = parentWorld ? parentWorld->mat * transform.mat() : transform.mat();
+        world.parentVersion = parentVersion;
+        world.bForceRebuild = false;
+        ++world.version;
+        return true;
+    }
+
+public:
+    /**
+     * Places child relative to parent (entt::null detaches it).
+     * The child's trans is kept as is, so it's reinterpreted in the parent's space.
+     */
+    bool setParent(entt::registry& EM, entt::entity child, entt::entity parent) {
+        for (auto e{parent}; e != entt::null; ) {
+            if (e == child) {
+                std::cout << "TransformHierarchy: parenting would create a cycle." << std::endl;
+                return false;
+            }
+            const auto* p = EM.try_get<component::parent>(e);
+            e = p ? p->entity : static_cast<entt::entity>(entt::null);
+        }
+
+        if (parent == entt::null)
+            EM.remove_if_exists<component::parent>(child);
+        else
+            EM.emplace_or_replace<component::parent>(child, parent);
+        // Rebuild the child's matrix even if its trans didn't change
+        if (auto world = EM.try_get<component::world>(child))
+            world->bForceRebuild = true;
+        bOrderDirty = true;
+        return true;
+    }
+
+    // Call after destroying entities in the hierarchy (new entities are picked up automatically)
+    void invalidate() { bOrderDirty = true; }
+
+    void update(entt::registry& EM) {
+        if (bOrderDirty || EM.view<component::trans>().size() != mNodeCount)
+            rebuild(EM);
+
+        std::atomic<std::size_t> recomputed{0};
+        for (const auto& level : mLevels) {
+            ThreadPool::get().parallelFor(level.size(), BATCH_SIZE, [&](std::size_t begin, std::size_t end) {
+                std::size_t count{0};
+                for (auto i{begin}; i < end; ++i)
+                    count += updateNode(EM, level[i]);
+                recomputed += count;
+            });
+        }
+        mRecomputed = recomputed;
+    }
+
+    // World matrices rebuilt by the last update
+    std::size_t recomputed() const { return mRecomputed; }
+    std::size_t size() const { return mNodeCount; }
+    std::size_t depth() const { return mLevels.size(); }
+};
+
+#endif // TRANSFORMHIERARCHY_H
@@ -0,0 +1,138 @@
+#ifndef UPLOADRING_H
+#define UPLOADRING_H
+
+#include <glad/glad.h>
+#include <vector>
+#include <cstddef>
+#include <iostream>
+#include <algorithm>
+#include "gpumemory.h"
+
+/**
+ * Ring buffer for data written by the CPU every frame.
+ * One persistently mapped buffer is split into a region per frame in flight,
+ * so the CPU writes straight into GPU visible memory while the GPU still reads
+ * the regions of earlier frames. A fence per region makes sure a region is only
+ * reused once the GPU is done with it, so there's no implicit driver sync like
+ * with glBufferSubData.
+ */
+class UploadRing
+{
+public:
+    struct allocation
+    {
+        std::byte* ptr{nullptr};
+        GLintptr offset{0};
+        GLsizeiptr size{0};
+
+        explicit operator bool() const { return ptr != nullptr; }
+    };
+
+private:
+    unsigned int mBuffer{0};
+    std::byte* mMapped{nullptr};
+    GLsizeiptr mFrameSize;
+    unsigned int mFramesInFlight;
+    unsigned int mRegion{0};
+    GLsizeiptr mHead{0};
+    std::vector<GLsync> mFences;
+    GLint mUniformAlignment{256}, mStorageAlignment{256};
+    // Frames where the CPU had to wait for the GPU to release a region
+    unsigned long long mStalls{0};
+    // Allocations that didn't fit, reported once per frame by beginFrame()
+    unsigned long long mFailures{0};
+    unsigned int mFrameFailures{0};
+    GLsizeiptr mFrameNeeded{0};
+
+public:
+    UploadRing(GLsizeiptr bytesPerFrame, unsigned int framesInFlight = 3)
+        : mFrameSize{bytesPerFrame}, mFramesInFlight{framesInFlight}, mFences(framesInFlight, nullptr)
+    {
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &mUniformAlignment);
+        glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &mStorageAlignment);
+        // Keep every region start aligned for any binding
+        const auto alignment = static_cast<GLsizeiptr>(std::max(mUniformAlignment, mStorageAlignment));
+        mFrameSize = (mFrameSize + alignment - 1) / alignment * alignment;
+
+        constexpr GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glCreateBuffers(1, &mBuffer);
+        GpuMemory::get().bufferStorage("UploadRing", mBuffer, mFrameSize * mFramesInFlight, nullptr, flags);
+        mMapped = static_cast<std::byte*>(glMapNamedBufferRange(mBuffer, 0, mFrameSize * mFramesInFlight, flags));
+        if (mMapped == nullptr)
+            std::cout << "UploadRing: failed to map buffer persistently." << std::endl;
+    }
+
+    UploadRing(const UploadRing&) = delete;
+    UploadRing(UploadRing&&) = delete;
+    void operator=(const UploadRing&) = delete;
+    void operator=(UploadRing&&) = delete;
+
+    // Waits until the GPU is done with the oldest region and starts writing into it.
+    void beginFrame() {
+        auto& fence = mFences[mRegion];
+        if (fence != nullptr) {
+            auto status = glClientWaitSync(fence, 0, 0);
+            if (status == GL_TIMEOUT_EXPIRED) {
+                ++mStalls;
+                do {
+                    status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+                } while (status == GL_TIMEOUT_EXPIRED);
+            }
+            glDeleteSync(fence);
+            fence = nullptr;
+        }
+
+        if (0 < mFrameFailures) {
+            std::cout << "UploadRing: " << mFrameFailures << " allocations didn't fit in the last frame (up to " << mFrameNeeded
+                << " bytes needed, " << mFrameSize << " available)." << std::endl;
+            mFrameFailures = 0;
+            mFrameNeeded = 0;
+        }
+        mHead = 0;
+    }
+
+    // Marks the region as in use by the GPU until everything submitted this frame is done.
+    void endFrame() {
+        mFences[mRegion] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        mRegion = (mRegion + 1) % mFramesInFlight;
+    }
+
+    // Allocates memory in this frame's region with the offset alignment required by target.
+    allocation allocate(GLsizeiptr size, GLenum target = GL_UNIFORM_BUFFER) {
+        const GLsizeiptr alignment = (target == GL_SHADER_STORAGE_BUFFER) ? mStorageAlignment
+            : (target == GL_UNIFORM_BUFFER) ? mUniformAlignment : 16;
+        const auto start = (mHead + alignment - 1) / alignment * alignment;
+        if (mMapped == nullptr || mFrameSize < start + size) {
+            ++mFailures;
+            ++mFrameFailures;
+            mFrameNeeded = std::max(mFrameNeeded, start + size);
+            return {};
+        }
+
+        mHead = start + size;
+        const auto offset = mRegion * mFrameSize + start;
+        return {mMapped + offset, offset, size};
+    }
+
+    void bindRange(GLenum target, GLuint index, const allocation& a) const {
+        glBindBufferRange(target, index, mBuffer, a.offset, a.size);
+    }
+
+    unsigned int get() const { return mBuffer; }
+    unsigned long long stalls() const { return mStalls; }
+    unsigned long long failures() const { return mFailures; }
+    // Bytes written so far this frame
+    GLsizeiptr used() const { return mHead; }
+
+    ~UploadRing() {
+        for (auto& fence : mFences)
+            if (fence != nullptr)
+                glDeleteSync(fence);
+
+        if (mMapped != nullptr)
+            glUnmapNamedBuffer(mBuffer);
+        GpuMemory::get().deleteBuffers(1, &mBuffer);
+    }
+};
+
+#endif // UPLOADRING_H
@@ -0,0 +1,305 @@
+#ifndef VERTEXFORMAT_H
+#define VERTEXFORMAT_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+#include <vector>
+#include <cstddef>
+#include <cstring>
+#include <cstdint>
+#include <initializer_list>
+#include <cmath>
+#include <algorithm>
+#include <ostream>
+#include <string>
+#include <utility>
+#include "components.h"
+
+/**
+ * Vertex layout descriptors.
+ * A layout describes how a struct vertex is stored in a vertex buffer,
+ * drives the vertex attribute setup and encodes/decodes vertices on the CPU.
+ *
+ * Attribute locations:
+ * 0 = position, 1 = float normal, 2 = uv, 3 = octahedral encoded normal.
+ * 4 is left for the per instance object index of GPU culled draws (see gpuculling.h).
+ * Shaders read normals through vertexNormal() in src/shaders/vertexformat.vert,
+ * built for one of the normal locations with shaderVar().
+ */
+namespace vertexformat {
+enum class preset : unsigned char {
+    // Full floats, same as struct vertex (32 bytes)
+    FLOAT,
+    // Half float positions where precise enough, octahedral normals and unorm16 uvs (16 bytes)
+    PACKED
+};
+
+enum class semantic : unsigned char { POSITION, NORMAL, UV };
+
+enum class encoding : unsigned char {
+    FLOAT3,
+    FLOAT2,
+    // 3 half floats padded to 4 to keep attributes 4 byte aligned
+    HALF4,
+    // Octahedral encoded unit vector in 2 x snorm16
+    OCT_SNORM16,
+    UNORM16X2
+};
+
+struct attribute
+{
+    semantic sem;
+    encoding enc;
+    GLuint location;
+    GLuint offset;
+
+    bool operator==(const attribute&) const = default;
+};
+
+// GL description of an encoding: component count, component type, normalized and size in bytes
+struct encodingInfo
+{
+    GLint size;
+    GLenum type;
+    GLboolean normalized;
+    GLuint bytes;
+};
+
+inline encodingInfo info(encoding enc) {
+    switch (enc) {
+        case encoding::FLOAT3:      return {3, GL_FLOAT, GL_FALSE, 12};
+        case encoding::FLOAT2:      return {2, GL_FLOAT, GL_FALSE, 8};
+        case encoding::HALF4:       return {4, GL_HALF_FLOAT, GL_FALSE, 8};
+        case encoding::OCT_SNORM16: return {2, GL_SHORT, GL_TRUE, 4};
+        case encoding::UNORM16X2:   return {2, GL_UNSIGNED_SHORT, GL_TRUE, 4};
+    }
+    return {};
+}
+
+// Octahedral mapping of a unit vector onto [-1, 1]^2
+inline glm::vec2 octEncode(glm::vec3 n) {
+    const auto l1 = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+    // Missing normals, decodes as +z
+    if (l1 <= 0.f)
+        return {};
+
+    n /= l1;
+    glm::vec2 e{n.x, n.y};
+    if (n.z < 0.f) {
+        e = glm::vec2{
+            (1.f - std::abs(n.y)) * (0.f <= n.x ? 1.f : -1.f),
+            (1.f - std::abs(n.x)) * (0.f <= n.y ? 1.f : -1.f)
+        };
+    }
+    return e;
+}
+
+// Same as octDecode in vertexformat.vert
+inline glm::vec3 octDecode(glm::vec2 e) {
+    glm::vec3 n{e.x, e.y, 1.f - std::abs(e.x) - std::abs(e.y)};
+    const auto t = std::max(-n.z, 0.f);
+    n.x += 0.f <= n.x ? -t : t;
+    n.y += 0.f <= n.y ? -t : t;
+    return glm::normalize(n);
+}
+
+struct layout
+{
+    std::vector<attribute> attributes;
+    GLsizei stride{0};
+
+    bool operator==(const layout&) const = default;
+
+    bool has(encoding enc) const {
+        return std::any_of(attributes.begin(), attributes.end(), [enc](const attribute& a) { return a.enc == enc; });
+    }
+
+    // Sets up the attributes of vao to read vbo through the given binding point (direct state access)
+    void attach(GLuint vao, GLuint vbo, GLuint binding = 0) const {
+        for (const auto& a : attributes) {
+            const auto i = info(a.enc);
+            glVertexArrayAttribFormat(vao, a.location, i.size, i.type, i.normalized, a.offset);
+            glVertexArrayAttribBinding(vao, a.location, binding);
+            glEnableVertexArrayAttrib(vao, a.location);
+        }
+        glVertexArrayVertexBuffer(vao, binding, vbo, 0, stride);
+    }
+
+    std::vector<std::byte> encode(const std::vector<vertex>& vertices) const {
+        std::vector<std::byte> data(vertices.size() * stride);
+        for (std::size_t i{0}; i < vertices.size(); ++i) {
+            auto* out = data.data() + i * stride;
+            const auto& v = vertices[i];
+            for (const auto& a : attributes) {
+                const glm::vec3 value = (a.sem == semantic::POSITION) ? v.pos
+                    : (a.sem == semantic::NORMAL) ? v.normal
+                    : glm::vec3{v.uv, 0.f};
+                write(out + a.offset, a.enc, value);
+            }
+        }
+        return data;
+    }
+
+    // CPU reference decode, following the GL conversion rules for each attribute type
+    vertex decode(const std::byte* in) const {
+        vertex v{};
+        for (const auto& a : attributes) {
+            const auto value = read(in + a.offset, a.enc);
+            if (a.sem == semantic::POSITION)
+                v.pos = value;
+            else if (a.sem == semantic::NORMAL)
+                v.normal = value;
+            else
+                v.uv = glm::vec2{value.x, value.y};
+        }
+        return v;
+    }
+
+private:
+    static void write(std::byte* out, encoding enc, const glm::vec3& value) {
+        switch (enc) {
+            case encoding::FLOAT3:
+            case encoding::FLOAT2: {
+                const float f[3]{value.x, value.y, value.z};
+                std::memcpy(out, f, info(enc).bytes);
+                break;
+            }
+            case encoding::HALF4: {
+                const std::uint16_t h[4]{glm::packHalf1x16(value.x), glm::packHalf1x16(value.y), glm::packHalf1x16(value.z), glm::packHalf1x16(1.f)};
+                std::memcpy(out, h, sizeof(h));
+                break;
+            }
+            case encoding::OCT_SNORM16: {
+                const auto packed = glm::packSnorm2x16(octEncode(value));
+                std::memcpy(out, &packed, sizeof(packed));
+                break;
+            }
+            case encoding::UNORM16X2: {
+                const auto packed = glm::packUnorm2x16(glm::vec2{value.x, value.y});
+                std::memcpy(out, &packed, sizeof(packed));
+                break;
+            }
+        }
+    }
+
+    static glm::vec3 read(const std::byte* in, encoding enc) {
+        glm::vec3 value{};
+        switch (enc) {
+            case encoding::FLOAT3:
+            case encoding::FLOAT2: {
+                float f[3]{};
+                std::memcpy(f, in, info(enc).bytes);
+                value = {f[0], f[1], f[2]};
+                break;
+            }
+            case encoding::HALF4: {
+                std::uint16_t h[4];
+                std::memcpy(h, in, sizeof(h));
+                value = {glm::unpackHalf1x16(h[0]), glm::unpackHalf1x16(h[1]), glm::unpackHalf1x16(h[2])};
+                break;
+            }
+            case encoding::OCT_SNORM16: {
+                std::uint32_t packed;
+                std::memcpy(&packed, in, sizeof(packed));
+                value = octDecode(glm::unpackSnorm2x16(packed));
+                break;
+            }
+            case encoding::UNORM16X2: {
+                std::uint32_t packed;
+                std::memcpy(&packed, in, sizeof(packed));
+                value = glm::vec3{glm::unpackUnorm2x16(packed), 0.f};
+                break;
+            }
+        }
+        return value;
+    }
+};
+
+inline layout makeLayout(std::initializer_list<std::pair<semantic, encoding>> attributes) {
+    layout l{};
+    for (const auto& [sem, enc] : attributes) {
+        const GLuint location = (sem == semantic::POSITION) ? 0
+            : (sem == semantic::UV) ? 2
+            : (enc == encoding::OCT_SNORM16) ? 3 : 1;
+        l.attributes.push_back({sem, enc, location, static_cast<GLuint>(l.stride)});
+        l.stride += info(enc).bytes;
+    }
+    return l;
+}
+
+// Same layout as struct vertex
+inline layout floats() {
+    return makeLayout({
+        {semantic::POSITION, encoding::FLOAT3},
+        {semantic::NORMAL, encoding::FLOAT3},
+        {semantic::UV, encoding::FLOAT2}
+    });
+}
+
+/**
+ * Packed layout for the given vertices.
+ * Positions are only stored as half floats if every component survives within
+ * positionTolerance (in model units), and uvs only as unorm16 if they're all inside [0, 1].
+ */
+inline layout packed(const std::vector<vertex>& vertices, float positionTolerance = 1e-3f) {
+    bool bHalfPos{true}, bUnormUV{true};
+    for (const auto& v : vertices) {
+        for (int i{0}; i < 3; ++i)
+            if (positionTolerance < std::abs(glm::unpackHalf1x16(glm::packHalf1x16(v.pos[i])) - v.pos[i]))
+                bHalfPos = false;
+        if (v.uv.x < 0.f || 1.f < v.uv.x || v.uv.y < 0.f || 1.f < v.uv.y)
+            bUnormUV = false;
+    }
+
+    return makeLayout({
+        {semantic::POSITION, bHalfPos ? encoding::HALF4 : encoding::FLOAT3},
+        {semantic::NORMAL, encoding::OCT_SNORM16},
+        {semantic::UV, bUnormUV ? encoding::UNORM16X2 : encoding::FLOAT2}
+    });
+}
+
+inline layout select(preset p, const std::vector<vertex>& vertices) {
+    return (p == preset::PACKED) ? packed(vertices) : floats();
+}
+
+// Shader variable building vertexformat.vert for the normals of the preset's layouts
+inline std::pair<std::string, std::string> shaderVar(preset p) {
+    return {"octnormals", (p == preset::PACKED) ? "1" : "0"};
+}
+
+struct validation
+{
+    GLsizei stride{0};
+    float maxPosError{0.f};
+    // In degrees
+    float maxNormalError{0.f};
+    float maxUVError{0.f};
+};
+
+// Encodes and decodes the vertices with the layout and measures the error against the float data
+inline validation validate(const std::vector<vertex>& vertices, const layout& l) {
+    validation result{.stride = l.stride};
+    const auto data = l.encode(vertices);
+    for (std::size_t i{0}; i < vertices.size(); ++i) {
+        const auto& v = vertices[i];
+        const auto d = l.decode(data.data() + i * l.stride);
+        result.maxPosError = std::max(result.maxPosError, glm::length(d.pos - v.pos));
+        result.maxUVError = std::max(result.maxUVError, glm::length(d.uv - v.uv));
+        if (0.f < glm::length(v.normal)) {
+            // atan2 keeps precision for tiny angles, unlike acos
+            const auto n = glm::normalize(v.normal);
+            const auto angle = std::atan2(glm::length(glm::cross(n, d.normal)), glm::dot(n, d.normal));
+            result.maxNormalError = std::max(result.maxNormalError, glm::degrees(angle));
+        }
+    }
+    return result;
+}
+
+inline std::ostream& operator<<(std::ostream& os, const validation& v) {
+    return os << v.stride << " bytes per vertex (" << sizeof(vertex) << " as floats), max error: position "
+        << v.maxPosError << ", normal " << v.maxNormalError << " deg, uv " << v.maxUVError;
+}
+}
+
+#endif // VERTEXFORMAT_H